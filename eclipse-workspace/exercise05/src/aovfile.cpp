@@ -0,0 +1,394 @@
+/**
+ * Tiled multi-channel image files, see aovfile.h.
+ */
+
+#include "aovfile.h"
+#include "utils/texel.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char AOV_MAGIC[4] = { 'A', 'O', 'V', '1' };
+/// Size of the fixed part of the header in bytes.
+static const long AOV_HEADER = 4 + 5 * sizeof(int);
+
+/// Runs shorter than this are stored as literals.
+#define AOV_MIN_RUN 3
+/// Longest run or literal sequence of one RLE packet.
+#define AOV_MAX_RUN 127
+
+/// Size of one value of a channel type in bytes.
+static inline int aov_type_bytes(int type)
+{
+	return type == AOV_HALF ? 2 : 4;
+}
+
+/**
+ * Prepares bytes for run length encoding: the low and high halves are
+ * split (even and odd bytes), then every byte is replaced by the difference
+ * to its predecessor, so smooth data turns into runs of similar bytes.
+ * @param out Out parameter: n bytes.
+ * @param in n bytes.
+ */
+static void aov_predict(unsigned char *out, const unsigned char *in, int n)
+{
+	unsigned char *t1 = out;
+	unsigned char *t2 = out + (n + 1) / 2;
+	for (int i = 0; i < n; i += 2)
+	{
+		*t1++ = in[i];
+		if (i + 1 < n)
+			*t2++ = in[i + 1];
+	}
+	int p = out[0];
+	for (int i = 1; i < n; i++)
+	{
+		int d = (int) out[i] - p + (128 + 256);
+		p = out[i];
+		out[i] = (unsigned char) d;
+	}
+}
+
+/**
+ * Reverts aov_predict().
+ * @param out Out parameter: n bytes.
+ * @param in n bytes, overwritten.
+ */
+static void aov_unpredict(unsigned char *out, unsigned char *in, int n)
+{
+	for (int i = 1; i < n; i++)
+		in[i] = (unsigned char) (in[i - 1] + in[i] - 128);
+	const unsigned char *t1 = in;
+	const unsigned char *t2 = in + (n + 1) / 2;
+	for (int i = 0; i < n; i += 2)
+	{
+		out[i] = *t1++;
+		if (i + 1 < n)
+			out[i + 1] = *t2++;
+	}
+}
+
+/**
+ * Run length encodes bytes: a packet is either a count c >= 0 followed by
+ * a byte repeated c + 1 times or a count -c followed by c literal bytes.
+ * @param out Out parameter: at least n + n / AOV_MAX_RUN + 1 bytes.
+ * @param in n bytes.
+ * @returns Number of bytes written to out.
+ */
+static int aov_rle_encode(signed char *out, const unsigned char *in, int n)
+{
+	const unsigned char *end = in + n;
+	const unsigned char *runStart = in;
+	const unsigned char *runEnd = in + 1;
+	signed char *o = out;
+
+	while (runStart < end)
+	{
+		while (runEnd < end && *runStart == *runEnd
+				&& runEnd - runStart - 1 < AOV_MAX_RUN)
+			runEnd++;
+
+		if (runEnd - runStart >= AOV_MIN_RUN)
+		{
+			*o++ = (signed char) ((runEnd - runStart) - 1);
+			*o++ = (signed char) *runStart;
+			runStart = runEnd;
+		}
+		else
+		{
+			// Extend the literal sequence until a run of AOV_MIN_RUN bytes starts.
+			while (runEnd < end
+					&& ((runEnd + 1 >= end || *runEnd != *(runEnd + 1))
+							|| (runEnd + 2 >= end || *(runEnd + 1) != *(runEnd + 2)))
+					&& runEnd - runStart < AOV_MAX_RUN)
+				runEnd++;
+			*o++ = (signed char) (runStart - runEnd);
+			while (runStart < runEnd)
+				*o++ = (signed char) *runStart++;
+		}
+		runEnd++;
+	}
+	return o - out;
+}
+
+/**
+ * Decodes the packets of aov_rle_encode().
+ * @param out Out parameter: n bytes.
+ * @param in Packets.
+ * @param size Size of the packets in bytes.
+ * @returns False if the packets are corrupt or do not decode to n bytes.
+ */
+static bool aov_rle_decode(unsigned char *out, int n, const signed char *in,
+		int size)
+{
+	const signed char *end = in + size;
+	unsigned char *o = out;
+	unsigned char *oend = out + n;
+	while (in < end)
+	{
+		if (*in < 0)
+		{
+			int count = -*in++;
+			if (count > end - in || count > oend - o)
+				return false;
+			memcpy(o, in, count);
+			in += count;
+			o += count;
+		}
+		else
+		{
+			int count = *in++ + 1;
+			if (in >= end || count > oend - o)
+				return false;
+			memset(o, *(const unsigned char*) in, count);
+			in++;
+			o += count;
+		}
+	}
+	return o == oend;
+}
+
+AovWriter::AovWriter(const char *file, int ResX, int ResY,
+		const AovChannel *channels, int numChannels, int compression) :
+		ResX(ResX), ResY(ResY), numChannels(numChannels),
+		compression(compression), ok(true)
+{
+	tilesX = (ResX + AOV_TILE - 1) / AOV_TILE;
+	tilesY = (ResY + AOV_TILE - 1) / AOV_TILE;
+	this->channels = new AovChannel[numChannels];
+	memcpy(this->channels, channels, numChannels * sizeof(AovChannel));
+	offsets = new long[tilesX * tilesY];
+	memset(offsets, 0, tilesX * tilesY * sizeof(long));
+	end = AOV_HEADER + numChannels * sizeof(AovChannel)
+			+ tilesX * tilesY * sizeof(long);
+	pthread_mutex_init(&lock, 0);
+
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	int header[5] = { ResX, ResY, AOV_TILE, numChannels, compression };
+	long size = numChannels * sizeof(AovChannel);
+	ok = pwrite(fd, AOV_MAGIC, 4, 0) == 4
+			&& pwrite(fd, header, sizeof(header), 4) == sizeof(header)
+			&& pwrite(fd, channels, size, AOV_HEADER) == size;
+}
+
+AovWriter::~AovWriter()
+{
+	Close();
+	delete[] channels;
+	delete[] offsets;
+	pthread_mutex_destroy(&lock);
+}
+
+int AovWriter::TileResX(int tx) const
+{
+	int res = ResX - tx * AOV_TILE;
+	return res < AOV_TILE ? res : AOV_TILE;
+}
+
+int AovWriter::TileResY(int ty) const
+{
+	int res = ResY - ty * AOV_TILE;
+	return res < AOV_TILE ? res : AOV_TILE;
+}
+
+bool AovWriter::WriteTile(int tx, int ty, const float *pixels)
+{
+	if (fd < 0)
+		return false;
+
+	int numPixels = TileResX(tx) * TileResY(ty);
+	int rawSize = 0;
+	for (int c = 0; c < numChannels; c++)
+		rawSize += numPixels * aov_type_bytes(channels[c].type);
+
+	// 3 int chunk header, then room for the raw data or the RLE packets.
+	int capacity = rawSize + rawSize / AOV_MAX_RUN + 1;
+	unsigned char *chunk = new unsigned char[3 * sizeof(int) + capacity];
+	unsigned char *raw = new unsigned char[2 * rawSize];
+	unsigned char *data = chunk + 3 * sizeof(int);
+
+	unsigned char *r = raw;
+	for (int c = 0; c < numChannels; c++)
+	{
+		const float *plane = pixels + (long) c * numPixels;
+		if (channels[c].type == AOV_HALF)
+			for (int i = 0; i < numPixels; i++, r += 2)
+			{
+				unsigned short h = float2half(plane[i]);
+				memcpy(r, &h, 2);
+			}
+		else
+		{
+			memcpy(r, plane, numPixels * sizeof(float));
+			r += numPixels * sizeof(float);
+		}
+	}
+
+	int packedSize = rawSize;
+	if (compression == AOV_RLE)
+	{
+		aov_predict(raw + rawSize, raw, rawSize);
+		packedSize = aov_rle_encode((signed char*) data, raw + rawSize, rawSize);
+	}
+	// Incompressible tiles are stored raw, like OpenEXR does.
+	if (packedSize >= rawSize)
+	{
+		packedSize = rawSize;
+		memcpy(data, raw, rawSize);
+	}
+	int header[3] = { tx, ty, packedSize };
+	memcpy(chunk, header, sizeof(header));
+	long size = sizeof(header) + packedSize;
+
+	pthread_mutex_lock(&lock);
+	long offset = end;
+	end += size;
+	offsets[ty * tilesX + tx] = offset;
+	pthread_mutex_unlock(&lock);
+
+	bool success = pwrite(fd, chunk, size, offset) == size;
+	delete[] chunk;
+	delete[] raw;
+	if (!success)
+	{
+		pthread_mutex_lock(&lock);
+		ok = false;
+		pthread_mutex_unlock(&lock);
+	}
+	return success;
+}
+
+bool AovWriter::Close()
+{
+	if (fd < 0)
+		return false;
+	long size = tilesX * tilesY * sizeof(long);
+	long pos = AOV_HEADER + numChannels * sizeof(AovChannel);
+	ok = pwrite(fd, offsets, size, pos) == size && ok;
+	ok = close(fd) == 0 && ok;
+	fd = -1;
+	return ok;
+}
+
+bool load_aov_channel(const char *file, const char *channel, float *&image,
+		int &ResX, int &ResY)
+{
+	int f = open(file, O_RDONLY);
+	if (f < 0)
+		return false;
+
+	char magic[4];
+	int header[5];
+	if (pread(f, magic, 4, 0) != 4 || memcmp(magic, AOV_MAGIC, 4) != 0
+			|| pread(f, header, sizeof(header), 4) != sizeof(header)
+			|| header[0] <= 0 || header[1] <= 0 || header[2] != AOV_TILE
+			|| header[3] <= 0)
+	{
+		close(f);
+		return false;
+	}
+	int numChannels = header[3];
+	int compression = header[4];
+
+	AovChannel *channels = new AovChannel[numChannels];
+	long size = numChannels * sizeof(AovChannel);
+	int index = -1;
+	if (pread(f, channels, size, AOV_HEADER) == size)
+		for (int c = 0; c < numChannels; c++)
+		{
+			channels[c].name[AOV_NAME - 1] = 0;
+			if (strcmp(channels[c].name, channel) == 0)
+				index = c;
+		}
+	if (index < 0)
+	{
+		delete[] channels;
+		close(f);
+		return false;
+	}
+
+	ResX = header[0];
+	ResY = header[1];
+	int tilesX = (ResX + AOV_TILE - 1) / AOV_TILE;
+	int tilesY = (ResY + AOV_TILE - 1) / AOV_TILE;
+	long *offsets = new long[tilesX * tilesY];
+	long tableSize = tilesX * tilesY * sizeof(long);
+	bool success = pread(f, offsets, tableSize, AOV_HEADER + size) == tableSize;
+
+	image = new float[(long) ResX * ResY];
+	memset(image, 0, (long) ResX * ResY * sizeof(float));
+
+	int maxRaw = 0;
+	for (int c = 0; c < numChannels; c++)
+		maxRaw += AOV_TILE * AOV_TILE * aov_type_bytes(channels[c].type);
+	unsigned char *packed = new unsigned char[maxRaw];
+	unsigned char *raw = new unsigned char[2 * maxRaw];
+
+	for (int t = 0; success && t < tilesX * tilesY; t++)
+	{
+		if (offsets[t] == 0)
+			continue;
+		int tx = t % tilesX, ty = t / tilesX;
+		int tileResX = ResX - tx * AOV_TILE < AOV_TILE ? ResX - tx * AOV_TILE : AOV_TILE;
+		int tileResY = ResY - ty * AOV_TILE < AOV_TILE ? ResY - ty * AOV_TILE : AOV_TILE;
+		int numPixels = tileResX * tileResY;
+		int rawSize = 0, channelStart = 0;
+		for (int c = 0; c < numChannels; c++)
+		{
+			if (c == index)
+				channelStart = rawSize;
+			rawSize += numPixels * aov_type_bytes(channels[c].type);
+		}
+
+		int chunk[3];
+		success = pread(f, chunk, sizeof(chunk), offsets[t]) == sizeof(chunk)
+				&& chunk[0] == tx && chunk[1] == ty && chunk[2] > 0
+				&& chunk[2] <= rawSize
+				&& pread(f, packed, chunk[2], offsets[t] + sizeof(chunk)) == chunk[2];
+		if (!success)
+			break;
+		if (chunk[2] == rawSize)
+			memcpy(raw, packed, rawSize);
+		else if (compression == AOV_RLE)
+		{
+			success = aov_rle_decode(raw + rawSize, rawSize,
+					(const signed char*) packed, chunk[2]);
+			aov_unpredict(raw, raw + rawSize, rawSize);
+		}
+		else
+			success = false;
+
+		const unsigned char *r = raw + channelStart;
+		for (int j = 0; success && j < tileResY; j++)
+		{
+			float *row = image + (long) (ty * AOV_TILE + j) * ResX + tx * AOV_TILE;
+			for (int i = 0; i < tileResX; i++)
+				if (channels[index].type == AOV_HALF)
+				{
+					unsigned short h;
+					memcpy(&h, r, 2);
+					row[i] = half2float(h);
+					r += 2;
+				}
+				else
+				{
+					memcpy(row + i, r, sizeof(float));
+					r += sizeof(float);
+				}
+		}
+	}
+
+	delete[] packed;
+	delete[] raw;
+	delete[] offsets;
+	delete[] channels;
+	close(f);
+	if (!success)
+	{
+		delete[] image;
+		image = 0;
+	}
+	return success;
+}
@@ -0,0 +1,139 @@
+/**
+ * Tiled multi-channel image files (.aov) for writing a render together
+ * with its arbitrary output variables (normal, albedo, depth, ...).
+ *
+ * The layout follows OpenEXR's tiled files: a channel list, a tile offset
+ * table and independently compressed tiles that are appended in the order
+ * they complete, so a render never needs all layers in memory at once.
+ */
+
+#ifndef AOVFILE_H
+#define AOVFILE_H
+
+#include <pthread.h>
+
+/// Edge length of a tile of an .aov file in pixels.
+#define AOV_TILE 64
+/// Maximum length of a channel name including the terminating 0.
+#define AOV_NAME 16
+
+/**
+ * Storage type of a channel.
+ */
+enum AovType
+{
+	/// IEEE 754 half float.
+	AOV_HALF = 1,
+	/// IEEE 754 single precision float.
+	AOV_FLOAT = 2
+};
+
+/**
+ * Compression of the tiles.
+ */
+enum AovCompression
+{
+	AOV_NONE = 0,
+	/// Bytes split into low/high halves, delta predicted and run length
+	/// encoded like OpenEXR's RLE_COMPRESSION. Lossless.
+	AOV_RLE = 1
+};
+
+/**
+ * Channel of an .aov file.
+ */
+struct AovChannel
+{
+	/// Name, layers are separated by a dot as in OpenEXR, e.g. "normal.X".
+	char name[AOV_NAME];
+	/// AovType of the stored values.
+	int type;
+};
+
+/**
+ * .aov file that is written tile by tile.
+ *
+ * File layout (little endian):
+ *   char[4] "AOV1"
+ *   int     ResX, ResY, AOV_TILE, numChannels, AovCompression
+ *   AovChannel channels[numChannels]
+ *   long    offset[number of tiles], 0 for tiles never written
+ *   tiles in any order: int tileX, tileY, packed size in bytes, data.
+ *   The unpacked data holds the channels one after the other, each
+ *   with the pixels of the (at the border partial) tile row by row.
+ *   A packed size equal to the unpacked size means the data is stored raw.
+ */
+struct AovWriter
+{
+	/// File descriptor, written with pwrite so all threads can share it.
+	int fd;
+	/// Size of the image in pixels.
+	int ResX, ResY;
+	/// Number of tiles in one row and column of the image.
+	int tilesX, tilesY;
+	/// Channels of every pixel.
+	AovChannel *channels;
+	int numChannels;
+	/// AovCompression of the tiles.
+	int compression;
+	/// File offset of every tile, written by Close().
+	long *offsets;
+	/// End of the file; tiles are appended here.
+	long end;
+	/// False once a write failed.
+	bool ok;
+	pthread_mutex_t lock;
+
+	/**
+	 * Creates the file and writes its header.
+	 * @param file Path of the file. Check fd >= 0 for success.
+	 * @param ResX Width of the image.
+	 * @param ResY Height of the image.
+	 * @param channels Channels of every pixel, copied.
+	 * @param numChannels Number of channels.
+	 * @param compression AovCompression of the tiles.
+	 */
+	AovWriter(const char *file, int ResX, int ResY, const AovChannel *channels,
+			int numChannels, int compression = AOV_RLE);
+
+	/**
+	 * Closes the file, see Close().
+	 */
+	~AovWriter();
+
+	/// Width of the tiles of column tx in pixels.
+	int TileResX(int tx) const;
+	/// Height of the tiles of row ty in pixels.
+	int TileResY(int ty) const;
+
+	/**
+	 * Encodes and appends one tile. Thread safe.
+	 * @param tx Tile column.
+	 * @param ty Tile row.
+	 * @param pixels numChannels planes of TileResX(tx) * TileResY(ty)
+	 * values, each row by row.
+	 * @returns False on write errors.
+	 */
+	bool WriteTile(int tx, int ty, const float *pixels);
+
+	/**
+	 * Writes the tile offset table and closes the file.
+	 * @returns True if the header and every tile were written.
+	 */
+	bool Close();
+};
+
+/**
+ * Reads one channel of an .aov file.
+ * @param file Path of the file.
+ * @param channel Name of the channel.
+ * @param image Out parameter: ResX * ResY values row by row, allocated with
+ * new[]. Pixels of tiles that were never written are 0.
+ * @param ResX Out parameter: Width of the image.
+ * @param ResY Out parameter: Height of the image.
+ * @returns False if the file could not be read or has no such channel.
+ */
+bool load_aov_channel(const char *file, const char *channel, float *&image,
+		int &ResX, int &ResY);
+
+#endif
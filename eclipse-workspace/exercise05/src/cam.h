@@ -20,6 +20,8 @@ struct Cam
 	float ratio;
 
 	float u0, u1, v0, v1;
+	/// Spread angle of a primary ray cone (one pixel).
+	float pixelSpread;
 
 	float speed;
 	int action;
@@ -47,6 +49,7 @@ struct Cam
 		v0 = -ratio;
 		v1 = ratio;
 		dist = 2.5f;
+		pixelSpread = atanf((u1 - u0) * rX / dist);
 
 		across = (u1 - u0) * u;
 		up = (v1 - v0) * v;
@@ -76,6 +79,7 @@ struct Cam
 		v0 = -ratio;
 		v1 = ratio;
 		dist = 2.5f;
+		pixelSpread = atanf((u1 - u0) * rX / dist);
 
 		across = (u1 - u0) * u;
 		up = (v1 - v0) * v;
@@ -102,7 +106,7 @@ inline Ray Cam::getRay(const float x, const float y) const
 	Vec3 dir = corner + (x * rX) * across + (y * rY) * up;
 	dir.normalize();
 
-	return Ray(eye, dir, 0.0f, RAY_MAX);
+	return Ray(eye, dir, 0.0f, RAY_MAX, 0.0f, pixelSpread);
 }
 
 inline void Cam::cam_move()
@@ -0,0 +1,206 @@
+/**
+ * Edge-avoiding a-trous denoiser, see denoise.h.
+ */
+
+#include "denoise.h"
+#include <math.h>
+
+/// Taps of the B3 spline.
+static const float b3[5] =
+{ 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+
+/// Luminance of a color.
+static inline float luminance(const Vec3 &c)
+{
+	return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+/// Factor the color is divided by: the albedo, 1 for black channels.
+static inline Vec3 demodulation(const Vec3 &albedo)
+{
+	return Vec3(albedo.x > 1e-3f ? albedo.x : 1.0f,
+			albedo.y > 1e-3f ? albedo.y : 1.0f,
+			albedo.z > 1e-3f ? albedo.z : 1.0f);
+}
+
+/// Weight of a tap by the angle between the normals.
+static inline float normal_weight(const Vec3 &n, const Vec3 &nq)
+{
+	float w = n * nq;
+	if (w <= 0.0f)
+		return 0.0f;
+	for (int k = 1; k < DENOISE_SIGMA_NORMAL; k *= 2)
+		w *= w;
+	return w;
+}
+
+/**
+ * Exponent of the weight of a tap by the depth difference.
+ * @param distance Distance of the tap to the center in pixels.
+ */
+static inline float depth_exponent(float z, float zq, float gradient,
+		float distance)
+{
+	return fabsf(z - zq) / (DENOISE_SIGMA_DEPTH * gradient * distance + 1e-4f);
+}
+
+Denoiser::Denoiser(int ResX, int ResY) :
+		ResX(ResX), ResY(ResY)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		illum[i] = new Vec3[ResX * ResY];
+		variance[i] = new float[ResX * ResY];
+	}
+	gradient = new float[ResX * ResY];
+}
+
+Denoiser::~Denoiser()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		delete[] illum[i];
+		delete[] variance[i];
+	}
+	delete[] gradient;
+}
+
+void Denoiser::Filter(Vec3 *out, const Vec3 *color, const Vec3 *normal,
+		const Vec3 *albedo, const float *depth)
+{
+	// Illumination and depth gradient.
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int y = 0; y < ResY; y++)
+		for (int x = 0; x < ResX; x++)
+		{
+			int p = x + y * ResX;
+			Vec3 a = demodulation(albedo[p]);
+			illum[0][p] = Vec3(color[p].x / a.x, color[p].y / a.y,
+					color[p].z / a.z);
+			float g = 0.0f;
+			if (depth[p] > 0.0f)
+			{
+				const int neighbors[4] = { x > 0 ? p - 1 : p, x < ResX - 1 ? p + 1 : p,
+						y > 0 ? p - ResX : p, y < ResY - 1 ? p + ResX : p };
+				for (int k = 0; k < 4; k++)
+					if (depth[neighbors[k]] > 0.0f)
+					{
+						float d = fabsf(depth[neighbors[k]] - depth[p]);
+						g = d > g ? d : g;
+					}
+			}
+			gradient[p] = g;
+		}
+
+	// Luminance variance in the 5x5 neighborhood on the same surface.
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int y = 0; y < ResY; y++)
+		for (int x = 0; x < ResX; x++)
+		{
+			int p = x + y * ResX;
+			float sum = 0.0f, sum2 = 0.0f, weights = 0.0f;
+			if (depth[p] > 0.0f)
+				for (int j = -2; j <= 2; j++)
+					for (int i = -2; i <= 2; i++)
+					{
+						int qx = x + i, qy = y + j;
+						if (qx < 0 || qx >= ResX || qy < 0 || qy >= ResY)
+							continue;
+						int q = qx + qy * ResX;
+						if (depth[q] <= 0.0f)
+							continue;
+						float w = normal_weight(normal[p], normal[q])
+								* expf(-depth_exponent(depth[p], depth[q], gradient[p],
+										sqrtf((float) (i * i + j * j))));
+						float l = luminance(illum[0][q]);
+						sum += w * l;
+						sum2 += w * l * l;
+						weights += w;
+					}
+			float mean = weights > 0.0f ? sum / weights : 0.0f;
+			float v = weights > 0.0f ? sum2 / weights - mean * mean : 0.0f;
+			variance[0][p] = v > 0.0f ? v : 0.0f;
+		}
+
+	int src = 0;
+	for (int iteration = 0; iteration < DENOISE_ITERATIONS; iteration++)
+	{
+		const int step = 1 << iteration;
+		const Vec3 *in = illum[src];
+		const float *var = variance[src];
+		Vec3 *filtered = illum[1 - src];
+		float *filteredVar = variance[1 - src];
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (int y = 0; y < ResY; y++)
+			for (int x = 0; x < ResX; x++)
+			{
+				int p = x + y * ResX;
+				if (depth[p] <= 0.0f)
+				{
+					filtered[p] = in[p];
+					filteredVar[p] = var[p];
+					continue;
+				}
+
+				// Standard deviation of the luminance, prefiltered 3x3.
+				float v = 0.0f, vw = 0.0f;
+				for (int j = -1; j <= 1; j++)
+					for (int i = -1; i <= 1; i++)
+					{
+						int qx = x + i, qy = y + j;
+						if (qx < 0 || qx >= ResX || qy < 0 || qy >= ResY)
+							continue;
+						float w = (2 - i * i) * (2 - j * j);
+						v += w * var[qx + qy * ResX];
+						vw += w;
+					}
+				const float sigmaL = DENOISE_SIGMA_LUMINANCE * sqrtf(v / vw) + 1e-4f;
+				const float l = luminance(in[p]);
+
+				Vec3 sum(0.0f);
+				float sumVar = 0.0f, weights = 0.0f;
+				for (int j = -2; j <= 2; j++)
+				{
+					int qy = y + j * step;
+					if (qy < 0 || qy >= ResY)
+						continue;
+					for (int i = -2; i <= 2; i++)
+					{
+						int qx = x + i * step;
+						if (qx < 0 || qx >= ResX)
+							continue;
+						int q = qx + qy * ResX;
+						float w = b3[i + 2] * b3[j + 2];
+						if (q != p)
+						{
+							if (depth[q] <= 0.0f)
+								continue;
+							w *= normal_weight(normal[p], normal[q])
+									* expf(-depth_exponent(depth[p], depth[q], gradient[p],
+											step * sqrtf((float) (i * i + j * j)))
+											- fabsf(luminance(in[q]) - l) / sigmaL);
+						}
+						sum += w * in[q];
+						sumVar += w * w * var[q];
+						weights += w;
+					}
+				}
+				filtered[p] = sum / weights;
+				filteredVar[p] = sumVar / (weights * weights);
+			}
+		src = 1 - src;
+	}
+
+	// Modulation with the albedo.
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < ResX * ResY; p++)
+		out[p] = Vec3::product(illum[src][p], demodulation(albedo[p]));
+}
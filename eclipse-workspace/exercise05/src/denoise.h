@@ -0,0 +1,64 @@
+/**
+ * Edge-avoiding a-trous denoiser for the progressively rendered image in
+ * the style of spatiotemporal variance-guided filtering (SVGF, Schied et
+ * al.), guided by the normal, depth and albedo of the primary hits.
+ */
+
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "utils/vec.h"
+
+/// Number of a-trous iterations; iteration i has its taps 2^i pixels apart.
+#define DENOISE_ITERATIONS 5
+/// Exponent of the cosine between normals in the normal weight.
+#define DENOISE_SIGMA_NORMAL 32
+/// Depth differences are compared to this times the local depth gradient.
+#define DENOISE_SIGMA_DEPTH 1.0f
+/// Luminance differences are compared to this times their standard deviation.
+#define DENOISE_SIGMA_LUMINANCE 16.0f
+
+/**
+ * Denoiser with the scratch buffers for one image size.
+ * @remarks The color is divided by the albedo, so textures are not blurred,
+ * and the remaining illumination is filtered DENOISE_ITERATIONS times with
+ * the 5x5 B3 spline taps. A tap is weighted down by differences in normal,
+ * depth (relative to the depth gradient) and luminance (relative to the
+ * standard deviation of the luminance, which is estimated in the 5x5
+ * neighborhood and filtered along with the color). Pixels without a hit
+ * (depth 0) are passed through. Rows are filtered in parallel (OPENMP).
+ */
+struct Denoiser
+{
+	/// Width of the image in pixels.
+	int ResX;
+	/// Height of the image in pixels.
+	int ResY;
+	/// Illumination (color / albedo), ping-ponged between the iterations.
+	Vec3 *illum[2];
+	/// Variance of the luminance of illum.
+	float *variance[2];
+	/// Largest depth difference to the neighboring pixels per pixel.
+	float *gradient;
+
+	/**
+	 * Allocates the scratch buffers.
+	 * @param ResX Width of the image in pixels.
+	 * @param ResY Height of the image in pixels.
+	 */
+	Denoiser(int ResX, int ResY);
+	~Denoiser();
+
+	/**
+	 * Denoises an image.
+	 * @param out Output parameter. Contains the denoised image. May be color.
+	 * @param color Noisy image.
+	 * @param normal Shading normals of the primary hits, facing the camera.
+	 * @param albedo Diffuse colors of the primary hits.
+	 * @param depth Distances of the primary hits, 0 for misses.
+	 */
+	void Filter(Vec3 *out, const Vec3 *color, const Vec3 *normal,
+			const Vec3 *albedo, const float *depth);
+};
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * Asynchronous frame output, see frameoutput.h.
+ */
+
+#include "frameoutput.h"
+#include "utils/fileio.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/time.h>
+
+static void encode_ppm(const char *file, float *image, int ResX, int ResY)
+{
+	save_image_ppm(file, image, ResX, ResY);
+}
+
+static void encode_pfm(const char *file, float *image, int ResX, int ResY)
+{
+	save_image_pfm(file, image, ResX, ResY);
+}
+
+static void encode_hdr(const char *file, float *image, int ResX, int ResY)
+{
+	save_image_hdr(file, image, ResX, ResY);
+}
+
+/// Known encoders, the first one is used for unknown extensions.
+static const FrameEncoder frame_encoders[] = {
+	{ ".ppm", true, encode_ppm },
+	{ ".pfm", false, encode_pfm },
+	{ ".hdr", false, encode_hdr }
+};
+
+const FrameEncoder* find_frame_encoder(const char *file)
+{
+	int len = strlen(file);
+	int num = sizeof(frame_encoders) / sizeof(frame_encoders[0]);
+	for (int i = 0; i < num; i++)
+	{
+		int ext = strlen(frame_encoders[i].extension);
+		if (len > ext && strcmp(file + len - ext, frame_encoders[i].extension) == 0)
+			return &frame_encoders[i];
+	}
+	return &frame_encoders[0];
+}
+
+/// Wall clock time in seconds.
+static double wall_time()
+{
+	timeval t;
+	gettimeofday(&t, 0);
+	return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+void format_frame_name(char *file, int size, const char *pattern, int frame)
+{
+	// The pattern is user input, so it is only used as a format string if
+	// its one conversion is %[0][width]d.
+	const char *conversion = strchr(pattern, '%');
+	bool valid = conversion != 0;
+	if (valid)
+	{
+		const char *c = conversion + 1;
+		if (*c == '0')
+			c++;
+		while (*c >= '0' && *c <= '9')
+			c++;
+		valid = *c == 'd' && c - conversion <= 4 && strchr(c, '%') == 0;
+	}
+	if (valid)
+		snprintf(file, size, pattern, frame);
+	else
+	{
+		strncpy(file, pattern, size - 1);
+		file[size - 1] = 0;
+	}
+}
+
+/// Main loop of the writer thread of a FrameOutput.
+static void* frame_writer(void *arg)
+{
+	FrameOutput *out = (FrameOutput*) arg;
+	long n = (long) out->ResX * out->ResY * 3;
+
+	pthread_mutex_lock(&out->lock);
+	while (true)
+	{
+		while (out->count == 0 && !out->stop)
+			pthread_cond_wait(&out->changed, &out->lock);
+		if (out->count == 0)
+			break;
+		// The slot stays counted while it is written, so Submit() cannot reuse it.
+		FrameSlot &slot = out->slots[out->head];
+		pthread_mutex_unlock(&out->lock);
+
+		if (slot.encoder->ldr && slot.exposure != 1.0f)
+			for (long i = 0; i < n; i++)
+				slot.pixels[i] *= slot.exposure;
+		slot.encoder->encode(slot.file, slot.pixels, out->ResX, out->ResY);
+
+		pthread_mutex_lock(&out->lock);
+		out->head = (out->head + 1) % out->numSlots;
+		out->count--;
+		out->written++;
+		pthread_cond_broadcast(&out->changed);
+	}
+	pthread_mutex_unlock(&out->lock);
+	return 0;
+}
+
+FrameOutput::FrameOutput(int ResX, int ResY, int numSlots) :
+		ResX(ResX), ResY(ResY), exposure(1.0f), numSlots(numSlots), head(0),
+		count(0), stop(false), written(0), stalled(0.0)
+{
+	slots = new FrameSlot[numSlots];
+	for (int i = 0; i < numSlots; i++)
+		slots[i].pixels = new float[(long) ResX * ResY * 3];
+	pthread_mutex_init(&lock, 0);
+	pthread_cond_init(&changed, 0);
+	pthread_create(&writer, 0, frame_writer, this);
+}
+
+FrameOutput::~FrameOutput()
+{
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writer, 0);
+
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&lock);
+	for (int i = 0; i < numSlots; i++)
+		delete[] slots[i].pixels;
+	delete[] slots;
+}
+
+void FrameOutput::Submit(const char *file, const Vec3 *image)
+{
+	pthread_mutex_lock(&lock);
+	if (count == numSlots)
+	{
+		double t0 = wall_time();
+		while (count == numSlots)
+			pthread_cond_wait(&changed, &lock);
+		stalled += wall_time() - t0;
+	}
+	// Only the submitting thread fills slots, so the copy needs no lock.
+	FrameSlot &slot = slots[(head + count) % numSlots];
+	pthread_mutex_unlock(&lock);
+
+	memcpy(slot.pixels, image, (long) ResX * ResY * sizeof(Vec3));
+	strncpy(slot.file, file, FRAME_OUTPUT_PATH - 1);
+	slot.file[FRAME_OUTPUT_PATH - 1] = 0;
+	slot.encoder = find_frame_encoder(file);
+	slot.exposure = exposure;
+
+	pthread_mutex_lock(&lock);
+	count++;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+}
+
+void FrameOutput::Flush()
+{
+	pthread_mutex_lock(&lock);
+	while (count > 0)
+		pthread_cond_wait(&changed, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+void FrameOutput::PrintStats() const
+{
+	if (written == 0)
+		return;
+	std::cout << "Frame output: " << written << " frames written, "
+			<< stalled << " s waiting for a free buffer" << std::endl;
+}
@@ -0,0 +1,129 @@
+/**
+ * Asynchronous frame output: finished frames are copied into one of a
+ * bounded number of buffers and tonemapped, encoded and written by a
+ * background thread while the next frame renders.
+ */
+
+#ifndef FRAMEOUTPUT_H
+#define FRAMEOUTPUT_H
+
+#include "utils/vec.h"
+#include <pthread.h>
+
+/// Default number of frames that may wait for or be in output at once.
+#define FRAME_OUTPUT_BUFFERS 3
+/// Maximum length of the file name of a queued frame.
+#define FRAME_OUTPUT_PATH 256
+
+/**
+ * Image file format a frame can be written in.
+ */
+struct FrameEncoder
+{
+	/// File extension including the dot, e.g. ".ppm".
+	const char *extension;
+	/// True if the format stores values in [0, 1] only; frames are tonemapped first.
+	bool ldr;
+	/**
+	 * Writes an image.
+	 * @param file Path of the file to write.
+	 * @param image ResX * ResY RGB float triples, may be modified.
+	 */
+	void (*encode)(const char *file, float *image, int ResX, int ResY);
+};
+
+/**
+ * Returns the encoder for the extension of a file name.
+ * @param file Path of the file to write.
+ * @returns Matching encoder, the PPM encoder for unknown extensions.
+ */
+const FrameEncoder* find_frame_encoder(const char *file);
+
+/**
+ * Formats the file name of a frame.
+ * @param file Output parameter. Receives the file name.
+ * @param size Size of file in bytes.
+ * @param pattern File name that may contain exactly one integer conversion
+ * %d, optionally zero padded with a width such as %04d, which is replaced
+ * by the frame number. Names with any other % are used as given.
+ * @param frame Frame number.
+ */
+void format_frame_name(char *file, int size, const char *pattern, int frame);
+
+/**
+ * Frame waiting for or being in output.
+ */
+struct FrameSlot
+{
+	/// Copy of the rendered image.
+	float *pixels;
+	/// Path of the file to write.
+	char file[FRAME_OUTPUT_PATH];
+	/// Format to write.
+	const FrameEncoder *encoder;
+	/// Exposure the frame is multiplied with if encoder is LDR.
+	float exposure;
+};
+
+/**
+ * Bounded queue of frames written by a background thread.
+ *
+ * Submit() only copies the image, so the render threads continue right away.
+ * If all buffers are in flight, Submit() blocks until the oldest frame is
+ * written (backpressure), so memory use stays bounded if the disk is slower
+ * than the renderer.
+ */
+struct FrameOutput
+{
+	/// Size of the frames.
+	int ResX, ResY;
+	/// Exposure applied before frames are written in a LDR format. Only
+	/// changed by the submitting thread; every frame keeps the value it was
+	/// submitted with.
+	float exposure;
+	/// Ring of numSlots buffers; head is the oldest queued frame.
+	FrameSlot *slots;
+	int numSlots, head, count;
+	/// Set by the destructor to stop the writer thread once the queue is empty.
+	bool stop;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	/// Signalled whenever a frame is queued or written.
+	pthread_cond_t changed;
+	/// Statistics: frames written and seconds Submit() waited for a free buffer.
+	long written;
+	double stalled;
+
+	/**
+	 * Allocates the buffers and starts the writer thread.
+	 * @param ResX Width of the frames.
+	 * @param ResY Height of the frames.
+	 * @param numSlots Maximum number of frames in flight.
+	 */
+	FrameOutput(int ResX, int ResY, int numSlots = FRAME_OUTPUT_BUFFERS);
+
+	/**
+	 * Writes all queued frames and stops the writer thread.
+	 */
+	~FrameOutput();
+
+	/**
+	 * Queues a frame for output.
+	 * @param file Path of the file to write, the extension selects the encoder.
+	 * @param image ResX * ResY pixels, copied before the call returns.
+	 */
+	void Submit(const char *file, const Vec3 *image);
+
+	/**
+	 * Waits until all queued frames are written.
+	 */
+	void Flush();
+
+	/**
+	 * Prints the number of written frames and the time spent in backpressure.
+	 * @remarks Prints nothing if no frame was written.
+	 */
+	void PrintStats() const;
+};
+
+#endif
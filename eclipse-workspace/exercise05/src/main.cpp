@@ -12,6 +12,11 @@
 #include "utils/vec.h"
 #include "utils/fileio.h"
 #include "utils/MersenneTwister.h"
+#include "texstream.h"
+#include "frameoutput.h"
+#include <cstring>
+#include <cstdlib>
+#include <sys/time.h>
 
 /// Renderer object
 Render *render;
@@ -21,6 +26,13 @@ Cam *cam;
 /// Currently selected shader
 int shader = 6;
 
+/// Whether the denoised image is shown and written (toggled with n).
+#ifdef DENOISE
+bool denoise = true;
+#else
+bool denoise = false;
+#endif
+
 #ifdef INTERACTIVE
 #include <SDL/SDL.h>
 #include <SDL_opengl.h>
@@ -86,6 +98,13 @@ void eventHandling()
 				shader = 6;
 				render->accum_index = 0;
 				break;
+			case SDLK_7:
+				shader = 7;
+				render->accum_index = 0;
+				break;
+			case SDLK_n:
+				denoise = !denoise;
+				break;
 			default:
 				break;
 			}
@@ -133,18 +152,162 @@ int ResX;
 /// Height of the rendered image.
 int ResY;
 
+/**
+ * Converts a .ppm or .hdr image into a streamable .ttx texture.
+ * @remarks The whole image and its mip chain are held in memory once
+ * while converting.
+ * @param in Path of the image. .hdr files are stored as FORMAT_RGBE,
+ * everything else is read as .ppm and stored as FORMAT_RGBA8, which keeps
+ * the bytes of the file.
+ * @param out Path of the .ttx file to write.
+ * @returns Exit code.
+ */
+int convertTexture(const char *in, const char *out)
+{
+	int len = strlen(in);
+	bool hdr = len > 4 && strcmp(in + len - 4, ".hdr") == 0;
+	int resX, resY;
+	float *image;
+	bool loaded = hdr ? load_image_hdr(in, image, resX, resY) :
+			load_image_ppm(in, image, resX, resY);
+	if (!loaded)
+	{
+		std::cerr << "Could not read " << in << std::endl;
+		return 1;
+	}
+
+	Texture tex(resX, resY, (Vec3*) image, hdr ? FORMAT_RGBE : FORMAT_RGBA8,
+			LAYOUT_LINEAR);
+	if (!save_texture_ttx(out, tex))
+	{
+		std::cerr << "Could not write " << out << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+/// Number of texture coordinates precomputed for benchTexture().
+#define BENCH_COORDS (1 << 20)
+
+/**
+ * Measures the bilinear sampling throughput of a texture.
+ * @remarks Single threaded, all samples are taken from mip level 0.
+ * @param tex Texture to sample.
+ * @param coords BENCH_COORDS texture coordinates, used in a loop.
+ * @param samples Number of samples to take.
+ * @param checksum In/out parameter: the samples are added to it, so they
+ * are not optimized away.
+ * @returns Samples per second.
+ */
+static double benchSampling(const Texture &tex, const Vec2 *coords, long samples,
+		float &checksum)
+{
+	timeval t0, t1;
+	Vec3 sum(0.0f, 0.0f, 0.0f);
+	gettimeofday(&t0, 0);
+	for (long i = 0; i < samples; i++)
+		sum += tex.GetMipmappedColor(coords[i & (BENCH_COORDS - 1)], 0);
+	gettimeofday(&t1, 0);
+	double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) * 1e-6;
+	checksum += sum[0] + sum[1] + sum[2];
+	return samples / seconds;
+}
+
+/**
+ * Compares the sampling throughput of LAYOUT_LINEAR and LAYOUT_TILED.
+ * @remarks Random coordinates are uniform over the texture. Coherent
+ * coordinates walk rows of a grid with one texel spacing that is rotated
+ * by 30 degrees, so consecutive bilinear footprints overlap like those of
+ * neighbouring pixels but do not follow the rows of the texture.
+ * @param in Path of a .ppm (stored as FORMAT_RGBA8) or .hdr (FORMAT_RGBE) image.
+ * @param samples Number of samples per measurement.
+ * @returns Exit code.
+ */
+int benchTexture(const char *in, long samples)
+{
+	int len = strlen(in);
+	bool hdr = len > 4 && strcmp(in + len - 4, ".hdr") == 0;
+	int resX, resY;
+	float *image;
+	bool loaded = hdr ? load_image_hdr(in, image, resX, resY) :
+			load_image_ppm(in, image, resX, resY);
+	if (!loaded)
+	{
+		std::cerr << "Could not read " << in << std::endl;
+		return 1;
+	}
+
+	Vec2 *random = new Vec2[BENCH_COORDS];
+	Vec2 *coherent = new Vec2[BENCH_COORDS];
+	MTRand rand(1337);
+	const float c = cosf(M_PI / 6.0f), s = sinf(M_PI / 6.0f);
+	for (int i = 0; i < BENCH_COORDS; i++)
+	{
+		random[i] = Vec2(rand.randExc(), rand.randExc());
+		float x = (i % resX) + 0.5f, y = (i / resX) + 0.5f;
+		coherent[i] = Vec2((c * x - s * y) / resX, (s * x + c * y) / resY);
+	}
+
+	const TexelLayout layouts[2] = { LAYOUT_LINEAR, LAYOUT_TILED };
+	const char *names[2] = { "linear", "tiled" };
+	for (int l = 0; l < 2; l++)
+	{
+		// Texture takes ownership of its input
+		float *copy = new float[(long) resX * resY * 3];
+		memcpy(copy, image, sizeof(float) * resX * resY * 3);
+		Texture tex(resX, resY, (Vec3*) copy, hdr ? FORMAT_RGBE : FORMAT_RGBA8,
+				layouts[l]);
+		float checksum = 0.0f;
+		double r = benchSampling(tex, random, samples, checksum);
+		double h = benchSampling(tex, coherent, samples, checksum);
+		std::cout << names[l] << ": random " << r * 1e-6 << "M samples/s, coherent "
+				<< h * 1e-6 << "M samples/s (checksum " << checksum << ")" << std::endl;
+	}
+
+	delete[] random;
+	delete[] coherent;
+	delete[] image;
+	return 0;
+}
+
 /**
  * Main program routine.
+ * @remarks "coRT -ttx in.ppm out.ttx" converts a texture instead of rendering,
+ * "coRT -benchtex in.ppm [samples]" measures its sampling throughput
+ * (see benchTexture()).
+ * Otherwise "coRT [scene [environment [frames [output [exposure]]]]]":
+ * without INTERACTIVE, frames progressive passes are rendered and every
+ * pass is written to output (a pattern with one %d or %04d such as
+ * frame%04d.hdr gets the frame number, see format_frame_name()) while the
+ * next one renders. Frames written as .ppm are multiplied with exposure
+ * (default 1) first. An output ending
+ * in .aov is rendered tile by tile with frames samples per pixel into a
+ * layered file instead, see Render::renderAov(). With DENOISE the frames
+ * are denoised (Render::denoise()) before they are shown or written.
  */
 int main(int argc, char **argv)
 {
+	if (argc == 4 && strcmp(argv[1], "-ttx") == 0)
+		return convertTexture(argv[2], argv[3]);
+	if (argc >= 3 && strcmp(argv[1], "-benchtex") == 0)
+		return benchTexture(argv[2], argc >= 4 ? atol(argv[3]) : 1L << 24);
+
 	const char* sceneFile = "CornellBox";
 	const char* envFile = 0;
+	int frames = 1;
+	const char* outFile = "image.ppm";
 
 	if (argc >= 2)
 		sceneFile = argv[1];
 	if (argc >= 3)
 		envFile = argv[2];
+	if (argc >= 4)
+		frames = atoi(argv[3]);
+	if (argc >= 5)
+		outFile = argv[4];
+	float exposure = 1.0f;
+	if (argc >= 6)
+		exposure = (float) atof(argv[5]);
 
 	Scene *scene = new Scene(sceneFile, envFile);
 
@@ -181,6 +344,9 @@ int main(int argc, char **argv)
 	}
 	std::cout << std::endl;
 
+	FrameOutput output(ResX, ResY);
+	output.exposure = exposure;
+
 #ifdef INTERACTIVE
 	initScreen(ResX, ResY);
 	char title[256];
@@ -194,8 +360,11 @@ int main(int argc, char **argv)
 		cam->cam_move();
 
 		render->render(shader);
+		if (denoise)
+			render->denoise();
 
-		glDrawPixels(ResX, ResY, GL_RGB, GL_FLOAT, (float*) render->image);
+		glDrawPixels(ResX, ResY, GL_RGB, GL_FLOAT,
+				(float*) (denoise ? render->denoised : render->image));
 		SDL_GL_SwapBuffers();
 		sprintf(title, "%g fps", fps);
 		SDL_WM_SetCaption(title, NULL);
@@ -208,10 +377,30 @@ int main(int argc, char **argv)
 			frame = 0;
 		}
 	}
+	output.Submit(outFile, denoise ? render->denoised : render->image);
 #else
-	render->render(shader);
+	int len = strlen(outFile);
+	if (len > 4 && strcmp(outFile + len - 4, ".aov") == 0)
+	{
+		if (!render->renderAov(outFile, shader, frames))
+			std::cerr << "Could not write " << outFile << std::endl;
+	}
+	else
+	{
+		char file[FRAME_OUTPUT_PATH];
+		for (int f = 0; f < frames; f++)
+		{
+			render->render(shader);
+			if (denoise)
+				render->denoise();
+			format_frame_name(file, sizeof(file), outFile, f);
+			output.Submit(file, denoise ? render->denoised : render->image);
+		}
+	}
 #endif
-	save_image_ppm("image.ppm", (float*) render->image, ResX, ResY);
+	output.Flush();
+	output.PrintStats();
+	TileCache::Global().PrintStats();
 
 	return 0;
 }
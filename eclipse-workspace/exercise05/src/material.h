@@ -8,10 +8,78 @@
 
 #include "utils/vec.h"
 #include "utils/MersenneTwister.h"
+#include "utils/texel.h"
+#include "utils/bc.h"
 #include "rtStructs.h"
+#include "texstream.h"
 #include <iostream>
+#include <cstring>
 #include <assert.h>
 
+/**
+ * Memory layout of the texels inside one mip level of a Texture.
+ */
+enum TexelLayout
+{
+	/// Plain row-major order: texel (x, y) is stored at y*mipWidth+x.
+	LAYOUT_LINEAR,
+	/**
+	 * Texels are grouped into TEX_TILE x TEX_TILE tiles which are stored
+	 * row by row. Inside a tile the texels are stored in Morton order, so
+	 * a bilinear footprint almost always stays inside one tile.
+	 */
+	LAYOUT_TILED
+};
+
+/**
+ * Encoding of a single texel of a Texture.
+ */
+enum TexelFormat
+{
+	/// Three 32 bit floats, 12 bytes per texel.
+	FORMAT_RGB32F,
+	/// 8 bit sRGB encoded RGB plus unused alpha, 4 bytes per texel. For LDR textures.
+	FORMAT_RGBA8_SRGB,
+	/// Three half floats, 6 bytes per texel. For HDR data.
+	FORMAT_RGB16F,
+	/// 8 bit RGB mantissas with a shared exponent as in .hdr files, 4 bytes per texel.
+	FORMAT_RGBE,
+	/// BC1 compressed 4x4 blocks with sRGB endpoints, 0.5 bytes per texel. For LDR textures.
+	FORMAT_BC1,
+	/// BC6H-like compressed 4x4 blocks with RGB9E5 endpoints, 1 byte per texel. For HDR data.
+	FORMAT_BC_HDR,
+	/// 8 bit linear RGB plus unused alpha, 4 bytes per texel. Keeps the bytes of .ppm textures.
+	FORMAT_RGBA8
+};
+
+/// Edge length of a tile in texels for LAYOUT_TILED (Morton code below assumes 4).
+#define TEX_TILE 4
+
+/// Number of entries of the per thread cache of decoded blocks (power of two).
+#define TEX_BLOCK_CACHE_SIZE 128
+
+/**
+ * Direct mapped cache of decoded 4x4 blocks of block compressed textures.
+ * @remarks Every thread has its own zero initialized instance, see
+ * Texture::DecodedBlock(). An entry with serial 0 is empty.
+ */
+struct TexBlockCache
+{
+	/// Texture::serial of the texture the cached block belongs to.
+	int serial[TEX_BLOCK_CACHE_SIZE];
+	/// Encoded block the entry was decoded from.
+	const unsigned char *block[TEX_BLOCK_CACHE_SIZE];
+	/// Decoded texels of the block, row by row.
+	Vec3 texels[TEX_BLOCK_CACHE_SIZE][16];
+};
+
+/// Layout used for textures loaded with the scene, see SConstruct option "tiled".
+#ifdef TEXTURE_TILED
+#define TEX_DEFAULT_LAYOUT LAYOUT_TILED
+#else
+#define TEX_DEFAULT_LAYOUT LAYOUT_LINEAR
+#endif
+
 /**
  * Texture which supports bilinear and trilinar sampling with mipmaps.
  */
@@ -23,115 +91,595 @@ struct Texture
 	int ResY;
 	/// Number of mip levels.
 	int MipLevels;
+	/// Memory layout of data, see TexelLayout.
+	TexelLayout layout;
+	/// Encoding of the texels in data, see TexelFormat.
+	TexelFormat format;
+	/// Size of one encoded texel in bytes, 0 for block compressed formats.
+	int texelBytes;
+	/// Size of one encoded 4x4 block in bytes, 0 for per texel formats.
+	int blockBytes;
+	/// Decoding table for FORMAT_RGBA8, FORMAT_RGBA8_SRGB, FORMAT_RGBE and FORMAT_BC1, 0 otherwise.
+	const float *decodeTable;
+	/// Unique number of this texture, identifies its blocks in TexBlockCache.
+	int serial;
 	/**
-	 * RGB data of all mip levels of the texture.
-	 * data[l][y*mipWidth+x] contains the color of the sample at texel (x, y) of mip level l.
+	 * Encoded RGB data of all mip levels of the texture.
+	 * data[l] + TexelIndex(l, x, y) * texelBytes contains the color of the sample at texel (x, y) of mip level l.
+	 * Block compressed formats always use LAYOUT_TILED and store one block
+	 * of blockBytes per tile instead.
 	 * Mip level 0 has the full texture resolution while the highest level is 1x1 pixel in size.
+	 * 0 for streamed textures.
+	 */
+	unsigned char **data;
+	/**
+	 * File the tiles of a streamed texture are read from through
+	 * TileCache::Global(), 0 if the texture is held in data.
+	 */
+	TiledTextureFile *stream;
+
+	/**
+	 * Returns the size of an encoded texel.
+	 * @param format Texel format.
+	 * @returns Size of one texel in bytes.
+	 */
+	static int TexelBytes(TexelFormat format)
+	{
+		switch (format)
+		{
+		case FORMAT_RGBA8:
+		case FORMAT_RGBA8_SRGB:
+		case FORMAT_RGBE:
+			return 4;
+		case FORMAT_RGB16F:
+			return 6;
+		case FORMAT_BC1:
+		case FORMAT_BC_HDR:
+			return 0;
+		default:
+			return 12;
+		}
+	}
+
+	/**
+	 * Returns the size of an encoded 4x4 block.
+	 * @param format Texel format.
+	 * @returns Size of one block in bytes, 0 if format is not block compressed.
+	 */
+	static int BlockBytes(TexelFormat format)
+	{
+		switch (format)
+		{
+		case FORMAT_BC1:
+			return BC1_BLOCK_BYTES;
+		case FORMAT_BC_HDR:
+			return BC_HDR_BLOCK_BYTES;
+		default:
+			return 0;
+		}
+	}
+
+	/**
+	 * Returns the cache of decoded blocks of the calling thread.
+	 */
+	static TexBlockCache& ThreadBlockCache()
+	{
+		static thread_local TexBlockCache cache;
+		return cache;
+	}
+
+	/**
+	 * Returns a new unique texture serial.
+	 * @remarks Not thread safe, textures are created while loading.
+	 */
+	static int NextSerial()
+	{
+		static int next = 0;
+		return ++next;
+	}
+
+	/**
+	 * Encodes a color into the texel format of the texture.
+	 * @param texel Out parameter: texelBytes bytes of storage.
+	 * @param color Color to encode.
+	 */
+	inline void EncodeTexel(unsigned char *texel, const Vec3 &color) const
+	{
+		switch (format)
+		{
+		case FORMAT_RGBA8:
+			float2unorm8(texel, color);
+			break;
+		case FORMAT_RGBA8_SRGB:
+			float2srgb8(texel, color);
+			break;
+		case FORMAT_RGB16F:
+		{
+			unsigned short h[3];
+			float2rgb16f(h, color);
+			memcpy(texel, h, sizeof(h));
+			break;
+		}
+		case FORMAT_RGBE:
+			float2rgbe8(texel, color);
+			break;
+		default:
+			memcpy(texel, &color, sizeof(Vec3));
+			break;
+		}
+	}
+
+	/**
+	 * Decodes a texel stored in the texel format of the texture.
+	 * @param texel Pointer to the encoded texel.
+	 * @returns Decoded color.
 	 */
-	Vec3 **data;
+	inline Vec3 DecodeTexel(const unsigned char *texel) const
+	{
+		switch (format)
+		{
+		case FORMAT_RGBA8:
+		case FORMAT_RGBA8_SRGB:
+			return srgb82float(texel, decodeTable);
+		case FORMAT_RGB16F:
+		{
+			unsigned short h[3];
+			memcpy(h, texel, sizeof(h));
+			return rgb16f2float(h);
+		}
+		case FORMAT_RGBE:
+			return rgbe82float(texel, decodeTable);
+		default:
+		{
+			Vec3 color;
+			memcpy(&color, texel, sizeof(Vec3));
+			return color;
+		}
+		}
+	}
 
 	/**
 	 * Calculates the width of a certain mip level.
-	 * @remarks Only defined for 1..MipLevels-1 !
 	 * @param level Mip level for which the width should be calculated.
-	 * @returns Width in pixels of the mip level.
+	 * @returns Width in pixels of the mip level (at least 1).
 	 */
-	inline int MipResX(int level)
+	inline int MipResX(int level) const
 	{
 		// Assures precondition in debug mode.
 		assert(level >= 0 && level < MipLevels);
 
 		// TODO 5.4 a) Calculate a mip level's width given the level.
-		return (int) ResX / pow(2, level);
+		int res = ResX >> level;
+		return res > 0 ? res : 1;
 	}
 
 	/**
 	 * Calculates the height of a certain mip level.
-	 * @remarks Only defined for 1..MipLevels-1 !
 	 * @param level Mip level for which the height should be calculated.
-	 * @returns Height in pixels of the mip level.
+	 * @returns Height in pixels of the mip level (at least 1).
 	 */
-	inline int MipResY(int level)
+	inline int MipResY(int level) const
 	{
-
 		// Assures precondition in debug mode.
 		assert(level >= 0 && level < MipLevels);
 
 		// TODO 5.4 a) Calculate a mip level's height given the level.
-		return (int) ResY / pow(2, level);
+		int res = ResY >> level;
+		return res > 0 ? res : 1;
+	}
+
+	/**
+	 * Calculates the number of tiles in one row of a mip level.
+	 * @param level Mip level.
+	 * @returns Number of (possibly partially filled) tiles per row.
+	 */
+	inline int MipTilesX(int level) const
+	{
+		return (MipResX(level) + TEX_TILE - 1) / TEX_TILE;
+	}
+
+	/**
+	 * Calculates the number of texels allocated for a mip level.
+	 * @remarks For LAYOUT_TILED this includes the padding of partial tiles.
+	 * @param level Mip level.
+	 * @returns Number of texels in data[level].
+	 */
+	inline int MipSize(int level) const
+	{
+		if (layout == LAYOUT_LINEAR)
+			return MipResX(level) * MipResY(level);
+		int tilesY = (MipResY(level) + TEX_TILE - 1) / TEX_TILE;
+		return MipTilesX(level) * tilesY * TEX_TILE * TEX_TILE;
+	}
+
+	/**
+	 * Calculates the number of bytes allocated for a mip level.
+	 * @param level Mip level.
+	 * @returns Size of data[level] in bytes.
+	 */
+	inline int MipBytes(int level) const
+	{
+		if (blockBytes)
+			return MipSize(level) / (TEX_TILE * TEX_TILE) * blockBytes;
+		return MipSize(level) * texelBytes;
+	}
+
+	/**
+	 * Calculates the distance in data[level] between two rows of texels
+	 * (LAYOUT_LINEAR) or two rows of tiles (LAYOUT_TILED).
+	 * @param level Mip level.
+	 * @returns Row pitch in texels.
+	 */
+	inline int MipPitch(int level) const
+	{
+		if (layout == LAYOUT_LINEAR)
+			return MipResX(level);
+		return MipTilesX(level) * TEX_TILE * TEX_TILE;
+	}
+
+	/**
+	 * Column part of the position of a texel inside data[level].
+	 * @remarks Both layouts are separable, so the index of texel (x, y) is
+	 * TexelOffsetX(x) + TexelOffsetY(y, MipPitch(level)). Samplers use this
+	 * to compute the offsets of a bilinear footprint only once per axis.
+	 * @param x Column of the texel, in [0, MipResX(level)).
+	 * @returns Column offset into data[level].
+	 */
+	inline int TexelOffsetX(unsigned int x) const
+	{
+		if (layout == LAYOUT_LINEAR)
+			return x;
+		// x bits of the 2 bit Morton code inside the 4x4 tile.
+		return (x / TEX_TILE) * TEX_TILE * TEX_TILE + ((x & 1) | ((x & 2) << 1));
+	}
+
+	/**
+	 * Row part of the position of a texel inside data[level].
+	 * @param y Row of the texel, in [0, MipResY(level)).
+	 * @param pitch MipPitch(level).
+	 * @returns Row offset into data[level].
+	 */
+	inline int TexelOffsetY(unsigned int y, int pitch) const
+	{
+		if (layout == LAYOUT_LINEAR)
+			return y * pitch;
+		// y bits of the 2 bit Morton code inside the 4x4 tile.
+		return (y / TEX_TILE) * pitch + (((y & 1) << 1) | ((y & 2) << 2));
+	}
+
+	/**
+	 * Maps texel coordinates to the position inside data[level].
+	 * @param level Mip level.
+	 * @param x Column of the texel, in [0, MipResX(level)).
+	 * @param y Row of the texel, in [0, MipResY(level)).
+	 * @returns Index into data[level].
+	 */
+	inline int TexelIndex(int level, int x, int y) const
+	{
+		return TexelOffsetX(x) + TexelOffsetY(y, MipPitch(level));
+	}
+
+	/**
+	 * Returns a single texel of a mip level.
+	 * @param level Mip level.
+	 * @param x Column of the texel, in [0, MipResX(level)).
+	 * @param y Row of the texel, in [0, MipResY(level)).
+	 * @returns Color of the texel.
+	 */
+	inline Vec3 Texel(int level, int x, int y) const
+	{
+		if (stream)
+			return StreamedTexel(level, x, y);
+		if (blockBytes)
+			return BlockTexel(level, x, y);
+		return DecodeTexel(data[level] + TexelIndex(level, x, y) * texelBytes);
+	}
+
+	/**
+	 * Returns the decoded texels of a block through the cache of the calling thread.
+	 * @param level Mip level.
+	 * @param tile Index of the block inside data[level].
+	 * @returns 16 decoded texels, row by row. Valid until the next call.
+	 */
+	inline const Vec3* DecodedBlock(int level, int tile) const
+	{
+		TexBlockCache &cache = ThreadBlockCache();
+		const unsigned char *block = data[level] + tile * blockBytes;
+		int entry = (tile + level * 97 + serial * 131) & (TEX_BLOCK_CACHE_SIZE - 1);
+
+		if (cache.serial[entry] != serial || cache.block[entry] != block)
+		{
+			if (format == FORMAT_BC1)
+				bc1_decode_block(cache.texels[entry], block, decodeTable);
+			else
+				bc_hdr_decode_block(cache.texels[entry], block);
+			cache.serial[entry] = serial;
+			cache.block[entry] = block;
+		}
+		return cache.texels[entry];
+	}
+
+	/**
+	 * Returns a single texel of a block compressed mip level.
+	 * @param level Mip level.
+	 * @param x Column of the texel, in [0, MipResX(level)).
+	 * @param y Row of the texel, in [0, MipResY(level)).
+	 * @returns Color of the texel.
+	 */
+	inline Vec3 BlockTexel(int level, int x, int y) const
+	{
+		int tile = (y / TEX_TILE) * MipTilesX(level) + x / TEX_TILE;
+		return DecodedBlock(level, tile)[(y & 3) * TEX_TILE + (x & 3)];
+	}
+
+	/**
+	 * Returns a single texel of a streamed texture.
+	 * @remarks Faults the tile in if it is not cached. Samplers which need
+	 * several texels use StreamedFootprint() instead.
+	 * @param level Mip level.
+	 * @param x Column of the texel, in [0, MipResX(level)).
+	 * @param y Row of the texel, in [0, MipResY(level)).
+	 * @returns Color of the texel.
+	 */
+	inline Vec3 StreamedTexel(int level, int x, int y) const
+	{
+		int tile = (y / TTX_TILE) * stream->TilesX(level) + x / TTX_TILE;
+		TileCacheEntry *entry = TileCache::Global().Acquire(stream, serial, level, tile);
+		Vec3 color = DecodeTexel(entry->texels
+				+ ((y % TTX_TILE) * stream->TileResX(level) + x % TTX_TILE) * texelBytes);
+		TileCache::Global().Release(entry);
+		return color;
+	}
+
+	/**
+	 * Returns the four texels of a bilinear footprint of a streamed texture.
+	 * @remarks Every distinct tile is acquired only once; most footprints
+	 * lie inside a single tile.
+	 * @param out Out parameter: texels (x0, y0), (x1, y0), (x0, y1), (x1, y1).
+	 * @param level Mip level.
+	 * @param x Columns x0, x1 of the footprint.
+	 * @param y Rows y0, y1 of the footprint.
+	 */
+	inline void StreamedFootprint(Vec3 out[4], int level, const int x[2],
+			const int y[2]) const
+	{
+		TileCache &cache = TileCache::Global();
+		int tilesX = stream->TilesX(level);
+		int tileResX = stream->TileResX(level);
+		int tiles[4];
+		TileCacheEntry *entries[4];
+		bool owner[4];
+		for (int i = 0; i < 4; i++)
+		{
+			int tx = x[i & 1], ty = y[i >> 1];
+			tiles[i] = (ty / TTX_TILE) * tilesX + tx / TTX_TILE;
+			owner[i] = true;
+			for (int j = 0; j < i && owner[i]; j++)
+				if (tiles[j] == tiles[i])
+				{
+					entries[i] = entries[j];
+					owner[i] = false;
+				}
+			if (owner[i])
+				entries[i] = cache.Acquire(stream, serial, level, tiles[i]);
+			out[i] = DecodeTexel(entries[i]->texels
+					+ ((ty % TTX_TILE) * tileResX + tx % TTX_TILE) * texelBytes);
+		}
+		for (int i = 0; i < 4; i++)
+			if (owner[i])
+				cache.Release(entries[i]);
 	}
 
 	/**
 	 * Initializes the texture and all its mip levels from given data.
+	 * @remarks Takes ownership of nData: the texels are encoded into a new
+	 * buffer and nData is deleted.
 	 * @param ResX Width of the texture in texels.
 	 * @param ResY Height of the texture in texels.
 	 * @param nData Data of the texture. One Vec3 per texel, rowwise.
+	 * @param format Encoding used to store the texels.
+	 * @param layout Memory layout used to store the texels.
 	 */
-	Texture(const int ResX, const int ResY, Vec3 *nData) :
-			ResX(ResX), ResY(ResY)
+	Texture(const int ResX, const int ResY, Vec3 *nData,
+			TexelFormat format = FORMAT_RGB32F,
+			TexelLayout layout = TEX_DEFAULT_LAYOUT) :
+			ResX(ResX), ResY(ResY), layout(layout), format(format), stream(0)
 	{
+		InitFormat();
+
 		// TODO 5.4 b) Calculate the amount of mip levels necessary to have 1x1 texel on the smallest level.
 		int larger_side = max(ResX, ResY);
 		MipLevels = (int) log2(larger_side) + 1;
 
-		data = new Vec3*[MipLevels];
-		data[0] = nData;
+		data = new unsigned char*[MipLevels];
+
+		// The mip chain is filtered in float and every level is encoded
+		// separately, so quantization errors do not accumulate.
+		Vec3 *levelData = nData;
+		for (int level = 0; level < MipLevels; level++)
+		{
+			data[level] = new unsigned char[MipBytes(level)];
+			memset(data[level], 0, MipBytes(level));
+			EncodeLevel(level, levelData);
 
-		// data[l][y*mipWidth+x] contains the color of the sample at texel (x, y) of mip level l.
-		// TODO 5.4 b) Calculate all mip levels.
-		for (int level = 1; level < MipLevels; level++){
+			// TODO 5.4 b) Calculate all mip levels.
+			if (level + 1 < MipLevels)
+			{
+				Vec3 *next = DownsampleLevel(level, levelData);
+				delete[] levelData;
+				levelData = next;
+			}
+		}
+		delete[] levelData;
+	}
 
-			int ResX_level = MipResX(level);
-			int ResY_level = MipResY(level);
+	/**
+	 * Filters a mip level down to the next level with a 2x2 box filter.
+	 * @param level Mip level of src.
+	 * @param src Texels of the level, rowwise.
+	 * @returns Newly allocated texels of level + 1, rowwise.
+	 */
+	Vec3* DownsampleLevel(int level, const Vec3 *src) const
+	{
+		int ResX_level = MipResX(level + 1);
+		int ResY_level = MipResY(level + 1);
+		int ResX_prev = MipResX(level);
+		int ResY_prev = MipResY(level);
 
-			Vec3 *level_data = new Vec3[ResX_level * ResY_level];
+		Vec3 *dst = new Vec3[ResX_level * ResY_level];
+		for (int y = 0; y < ResY_level; y++)
+		{
+			// Clamp for the sides which are already down to 1 texel.
+			int y0 = y * 2;
+			int y1 = y * 2 + 1 < ResY_prev ? y * 2 + 1 : ResY_prev - 1;
+			for (int x = 0; x < ResX_level; x++)
+			{
+				int x0 = x * 2;
+				int x1 = x * 2 + 1 < ResX_prev ? x * 2 + 1 : ResX_prev - 1;
+				dst[y * ResX_level + x] = (src[y0 * ResX_prev + x0]
+						+ src[y1 * ResX_prev + x0] + src[y0 * ResX_prev + x1]
+						+ src[y1 * ResX_prev + x1]) / 4;
+			}
+		}
+		return dst;
+	}
 
-			data[level] = level_data;
+	/**
+	 * Encodes the texels of a mip level into data[level].
+	 * @param level Mip level.
+	 * @param src Texels of the level, rowwise.
+	 */
+	void EncodeLevel(int level, const Vec3 *src)
+	{
+		int resX = MipResX(level);
+		int resY = MipResY(level);
 
-			for (int x=0; x < ResX_level; x++){
-				for (int y=0; y < ResY_level; y++){
-					data[level][y*ResX_level+x] =
-							(data[level-1][(y*2) * MipResX(level-1) + (x*2)] +
-							data[level-1][(y*2 + 1) * MipResX(level-1) + (x*2)] +
-							data[level-1][(y*2) * MipResX(level-1) + (x*2 + 1)] +
-							data[level-1][(y*2 + 1) * MipResX(level-1) + (x*2 + 1)])
-							/ 4;
+		if (!blockBytes)
+		{
+			for (int y = 0; y < resY; y++)
+				for (int x = 0; x < resX; x++)
+					EncodeTexel(data[level] + TexelIndex(level, x, y) * texelBytes,
+							src[y * resX + x]);
+			return;
+		}
 
-				}
+		int tilesX = MipTilesX(level);
+		int tilesY = (resY + TEX_TILE - 1) / TEX_TILE;
+		for (int ty = 0; ty < tilesY; ty++)
+			for (int tx = 0; tx < tilesX; tx++)
+			{
+				// Partial blocks at the border repeat the last row/column.
+				Vec3 block[16];
+				for (int j = 0; j < TEX_TILE; j++)
+					for (int i = 0; i < TEX_TILE; i++)
+					{
+						int x = min(tx * TEX_TILE + i, resX - 1);
+						int y = min(ty * TEX_TILE + j, resY - 1);
+						block[j * TEX_TILE + i] = src[y * resX + x];
+					}
+				unsigned char *out = data[level] + (ty * tilesX + tx) * blockBytes;
+				if (format == FORMAT_BC1)
+					bc1_encode_block(out, block);
+				else
+					bc_hdr_encode_block(out, block);
 			}
-		}
+	}
+
+	/**
+	 * Initializes a texture whose tiles are streamed from a .ttx file on demand.
+	 * @remarks Takes ownership of file. Only the tile index is held in memory,
+	 * the tiles themselves share the budget of TileCache::Global().
+	 * @param file Opened .ttx file (file->fd >= 0).
+	 */
+	Texture(TiledTextureFile *file) :
+			ResX(file->ResX), ResY(file->ResY), MipLevels(file->MipLevels), layout(
+					LAYOUT_LINEAR), format((TexelFormat) file->format), data(0), stream(
+					file)
+	{
+		InitFormat();
 	}
 
 	/**
 	 * Copy constructor that performs deep copies.
+	 * @remarks Copies of streamed textures reopen the file.
 	 */
 	Texture(const Texture &original) :
 			ResX(original.ResX), ResY(original.ResY), MipLevels(
-					original.MipLevels)
+					original.MipLevels), layout(original.layout), format(
+					original.format), data(0), stream(0)
 	{
-		data = new Vec3*[MipLevels];
+		InitFormat();
+
+		if (original.stream)
+		{
+			stream = new TiledTextureFile(original.stream->path);
+			return;
+		}
+
+		data = new unsigned char*[MipLevels];
 		for (int l = 0; l < MipLevels; l++)
 		{
 			if (original.data[l])
 			{
-				data[l] = new Vec3[MipResX(l) * MipResY(l)];
-				for (int p = 0; p < MipResX(l) * MipResY(l); p++)
-					data[l][p] = original.data[l][p];
+				data[l] = new unsigned char[MipBytes(l)];
+				memcpy(data[l], original.data[l], MipBytes(l));
 			}
 			else
 				data[l] = 0;
 		}
 	}
 
+	/**
+	 * Sets texelBytes, blockBytes, decodeTable and serial according to format.
+	 * @remarks Also builds the shared decoding tables, which therefore happens
+	 * while loading and not concurrently from the render threads. Block
+	 * compressed formats force LAYOUT_TILED.
+	 */
+	void InitFormat()
+	{
+		texelBytes = TexelBytes(format);
+		blockBytes = BlockBytes(format);
+		serial = NextSerial();
+		if (blockBytes)
+			layout = LAYOUT_TILED;
+		if (format == FORMAT_RGBA8)
+			decodeTable = unorm8_table();
+		else if (format == FORMAT_RGBA8_SRGB || format == FORMAT_BC1)
+			decodeTable = srgb8_table();
+		else if (format == FORMAT_RGBE)
+			decodeTable = rgbe_exponent_table();
+		else
+			decodeTable = 0;
+	}
+
+	/**
+	 * Calculates the memory used by the texels of all mip levels.
+	 * @returns Size in bytes, 0 for streamed textures.
+	 */
+	long MemorySize() const
+	{
+		if (stream)
+			return 0;
+		long size = 0;
+		for (int l = 0; l < MipLevels; l++)
+			size += MipBytes(l);
+		return size;
+	}
+
 	/**
 	 * Destroys all the data belonging to the texture.
 	 */
 	~Texture()
 	{
-		for (int l = 0; l < MipLevels; l++)
-			if (data[l])
-				delete[] data[l];
-		delete[] data;
+		if (data)
+		{
+			for (int l = 0; l < MipLevels; l++)
+				if (data[l])
+					delete[] data[l];
+			delete[] data;
+		}
+		if (stream)
+			delete stream;
 	}
 
 	/**
@@ -141,7 +689,7 @@ struct Texture
 	 * @param level Mip level from which the sample should be calculated.
 	 * @returns Color sample at the given position.
 	 */
-	Vec3 GetMipmappedColor(Vec2 coords, int level)
+	Vec3 GetMipmappedColor(Vec2 coords, int level) const
 	{
 		// TODO 5.4 c) Return the sample at coords from the given level (from data[level] instead of data[0])
 		// Check if level is > MipLevels or < 0:
@@ -149,31 +697,56 @@ struct Texture
 		ceiled_level = ceiled_level < 0 ? 0 : ceiled_level;
 
 		int l = ceiled_level;
+		int resX = MipResX(l);
+		int resY = MipResY(l);
 
-		coords[0] = fmod(coords[0], 1.0f);
-		coords[1] = -fmod(coords[1], 1.0f);
-		if (coords[0] < 0.0f)
-			coords[0] += 1.0f;
-		if (coords[1] < 0.0f)
-			coords[1] += 1.0f;
+		// Wrap to [0, 1), v is flipped. floorf is much cheaper than fmod.
+		coords[0] = coords[0] - floorf(coords[0]);
+		coords[1] = -coords[1] - floorf(-coords[1]);
 
-		float c0 = coords[0] * (float) MipResX(l);
-		float c1 = coords[1] * (float) MipResY(l);
+		float c0 = coords[0] * (float) resX;
+		float c1 = coords[1] * (float) resY;
 
-
-		// interpolate
+		// interpolate, wrapping the upper neighbours around the border
 		int x_low = (int) c0;
-		int x_up = x_low + 1;
 		int y_low = (int) c1;
-		int y_up = y_low + 1;
-
 		float rel_x = c0 - x_low;
 		float rel_y = c1 - y_low;
 
-		Vec3 color = (data[l][y_low * MipResX(l) + x_low] * (1-rel_x) +
-				data[l][y_low * MipResX(l) + x_up] * rel_x) * (1-rel_y) +
-				(data[l][y_up * MipResX(l) + x_low] * (1-rel_x) +
-				data[l][y_up * MipResX(l) + x_up] * rel_x) * rel_y;
+		if (x_low >= resX)
+			x_low = resX - 1;
+		if (y_low >= resY)
+			y_low = resY - 1;
+		int x_up = x_low + 1 < resX ? x_low + 1 : 0;
+		int y_up = y_low + 1 < resY ? y_low + 1 : 0;
+
+		if (stream)
+		{
+			Vec3 t[4];
+			int xs[2] = { x_low, x_up };
+			int ys[2] = { y_low, y_up };
+			StreamedFootprint(t, l, xs, ys);
+			return (t[0] * (1 - rel_x) + t[1] * rel_x) * (1 - rel_y)
+					+ (t[2] * (1 - rel_x) + t[3] * rel_x) * rel_y;
+		}
+
+		if (blockBytes)
+			return (BlockTexel(l, x_low, y_low) * (1 - rel_x)
+					+ BlockTexel(l, x_up, y_low) * rel_x) * (1 - rel_y)
+					+ (BlockTexel(l, x_low, y_up) * (1 - rel_x)
+							+ BlockTexel(l, x_up, y_up) * rel_x) * rel_y;
+
+		const unsigned char *texels = data[l];
+		int pitch = MipPitch(l);
+		int ox_low = TexelOffsetX(x_low);
+		int ox_up = TexelOffsetX(x_up);
+		int oy_low = TexelOffsetY(y_low, pitch);
+		int oy_up = TexelOffsetY(y_up, pitch);
+
+		Vec3 color = (DecodeTexel(texels + (oy_low + ox_low) * texelBytes) * (1 - rel_x)
+				+ DecodeTexel(texels + (oy_low + ox_up) * texelBytes) * rel_x) * (1 - rel_y)
+				+ (DecodeTexel(texels + (oy_up + ox_low) * texelBytes) * (1 - rel_x)
+						+ DecodeTexel(texels + (oy_up + ox_up) * texelBytes) * rel_x) * rel_y;
 
 		return color;
 	}
@@ -185,19 +758,18 @@ struct Texture
 	 * @param level Mip level which will be used for trilinear interpolation.
 	 * @returns Color sample at the given position.
 	 */
-	Vec3 GetColor(Vec2 coords)
+	Vec3 GetColor(Vec2 coords) const
 	{
-		coords[0] = fmod(coords[0], 1.0f);
-		coords[1] = -fmod(coords[1], 1.0f);
-		if (coords[0] < 0.0f)
-			coords[0] += 1.0f;
-		if (coords[1] < 0.0f)
-			coords[1] += 1.0f;
+		// Wrap to [0, 1), v is flipped. floorf is much cheaper than fmod.
+		coords[0] = coords[0] - floorf(coords[0]);
+		coords[1] = -coords[1] - floorf(-coords[1]);
 
-		float c0 = coords[0] * (float) ResX;
-		float c1 = coords[1] * (float) ResY;
+		int x = (int) (coords[0] * (float) ResX);
+		int y = (int) (coords[1] * (float) ResY);
+		x = x < ResX ? x : ResX - 1;
+		y = y < ResY ? y : ResY - 1;
 
-		return data[0][(int) c1 * ResX + (int) c0];
+		return Texel(0, x, y);
 	}
 };
 
@@ -293,6 +865,11 @@ struct Material
 		if (!tex)
 			return Vec3(1.0f);
 
+		// Beyond the coarsest level a single fetch is enough.
+		mipLevel = mipLevel > 0.0f ? mipLevel : 0.0f;
+		if (mipLevel >= (float) (tex->MipLevels - 1))
+			return tex->GetMipmappedColor(coords, tex->MipLevels - 1);
+
 		// Interpolate between the two nearest mipLevels:
 		int l_low = (int) mipLevel;
 		int l_up = l_low + 1;
@@ -4,6 +4,7 @@
  */
 
 #include "render.h"
+#include "aovfile.h"
 
 #include <omp.h>
 
@@ -19,6 +20,11 @@ Render::Render(Scene *scene) :
 	image = new Vec3[ResX * ResY];
 	for (int i = 0; i < ResX * ResY; i++)
 		image[i] = Vec3(0.0f, 0.0f, 0.0f);
+	guide_normal = new Vec3[ResX * ResY];
+	guide_albedo = new Vec3[ResX * ResY];
+	guide_depth = new float[ResX * ResY];
+	denoised = new Vec3[ResX * ResY];
+	denoiser = 0;
 
 #ifndef OPENMP
 	mtrand = new MTRand*[1];
@@ -35,6 +41,11 @@ Render::~Render()
 {
 	delete accel;
 	delete[] image;
+	delete[] guide_normal;
+	delete[] guide_albedo;
+	delete[] guide_depth;
+	delete[] denoised;
+	delete denoiser;
 #ifndef OPENMP
 	delete mtrand[0];
 #else
@@ -73,50 +84,198 @@ void Render::render(int shader)
 
 			HitRec rec = accel->intersect(ray);
 
-			Vec3 color(0.0f, 0.0f, 0.0f);
-			if (rec.id != -1)
+			// Guides of the denoiser, fixed while the accumulation goes on.
+			if (accum_index == 1)
 			{
-				switch (shader)
+				int p = x + y * ResX;
+				guide_normal[p] = Vec3(0.0f);
+				guide_albedo[p] = Vec3(0.0f);
+				guide_depth[p] = 0.0f;
+				if (rec.id != -1)
 				{
-				case 1:
-					color = shade_debug_normal(ray, rec);
-					break;
-				case 2:
-					color = shade_debug_uv(ray, rec);
-					break;
-				case 3:
-					color = shade_debug_miplevel(ray, rec);
-					break;
-				case 4:
-					color = shade_noshading(ray, rec);
-					break;
-				case 5:
-					color = shade_simple(ray, rec);
-					break;
-				case 6:
-					color = shade_path(ray, rec, 0, thread);
-					break;
-				default:
-					color = shade_noshading(ray, rec);
-					break;
+					guide_normal[p] = scene->getShadingNormal(ray, rec.id);
+					if (guide_normal[p] * ray.dir > 0.0f)
+						guide_normal[p] *= -1.0f;
+					guide_albedo[p] = shade_noshading(ray, rec);
+					guide_depth[p] = rec.dist;
 				}
 			}
-			else if (scene->environment != NULL)
-			{
-				color = scene->getEnvironment(ray.dir);
-			}
+
+			Vec3 color = shade(ray, rec, shader, thread);
 			image[x + y * ResX] += color * inv_accum;
 		}
 	}
 }
 
+void Render::denoise()
+{
+	if (!denoiser)
+		denoiser = new Denoiser(ResX, ResY);
+	denoiser->Filter(denoised, image, guide_normal, guide_albedo,
+			guide_depth);
+}
+
+
+/// Channels written by Render::renderAov, in the order of the tile planes.
+static const AovChannel render_aovs[] = {
+	{ "R", AOV_HALF }, { "G", AOV_HALF }, { "B", AOV_HALF },
+	{ "normal.X", AOV_HALF }, { "normal.Y", AOV_HALF }, { "normal.Z", AOV_HALF },
+	{ "albedo.R", AOV_HALF }, { "albedo.G", AOV_HALF }, { "albedo.B", AOV_HALF },
+	{ "depth.Z", AOV_FLOAT },
+	{ "samples.N", AOV_FLOAT },
+	{ "variance.R", AOV_HALF }, { "variance.G", AOV_HALF }, { "variance.B", AOV_HALF }
+};
+/// Number of channels in render_aovs.
+#define RENDER_AOVS ((int) (sizeof(render_aovs) / sizeof(render_aovs[0])))
+
+bool Render::renderAov(const char *file, int shader, int spp)
+{
+	AovWriter out(file, ResX, ResY, render_aovs, RENDER_AOVS);
+	if (out.fd < 0)
+		return false;
+
+	int numTiles = out.tilesX * out.tilesY;
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+#ifndef OPENMP
+		int thread = 0;
+#else
+		int thread = omp_get_thread_num();
+#endif
+		// Only the layers of the tile in flight are held in memory.
+		float *planes = new float[AOV_TILE * AOV_TILE * RENDER_AOVS];
+
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for (int t = 0; t < numTiles; t++)
+		{
+			int tx = t % out.tilesX, ty = t / out.tilesX;
+			int tileResX = out.TileResX(tx), tileResY = out.TileResY(ty);
+			int numPixels = tileResX * tileResY;
+
+			for (int j = 0; j < tileResY; j++)
+				for (int i = 0; i < tileResX; i++)
+				{
+					int x = tx * AOV_TILE + i, y = ty * AOV_TILE + j;
+					Ray ray = cam->getRay((float) x, (float) y);
+					HitRec rec = accel->intersect(ray);
+
+					Vec3 normal(0.0f), albedo(0.0f);
+					float depth = 0.0f;
+					if (rec.id != -1)
+					{
+						normal = scene->getShadingNormal(ray, rec.id);
+						if (normal * ray.dir > 0.0f)
+							normal *= -1.0f;
+						albedo = shade_noshading(ray, rec);
+						depth = rec.dist;
+					}
+
+					// The primary ray is fixed, so only path traced hits are noisy.
+					int n = shader == 6 && rec.id != -1 ? spp : 1;
+					Vec3 mean(0.0f), m2(0.0f);
+					for (int s = 0; s < n; s++)
+					{
+						Ray r = ray;
+						HitRec h = rec;
+						Vec3 color = shade(r, h, shader, thread);
+						Vec3 delta = color - mean;
+						mean += delta / (float) (s + 1);
+						m2 += Vec3::product(delta, color - mean);
+					}
+					// Variance of the mean, not of a single sample.
+					Vec3 variance = n > 1 ? m2 / (float) (n * (n - 1)) : Vec3(0.0f);
+
+					float values[RENDER_AOVS] = { mean.x, mean.y, mean.z, normal.x,
+							normal.y, normal.z, albedo.x, albedo.y, albedo.z, depth,
+							(float) n, variance.x, variance.y, variance.z };
+					int p = j * tileResX + i;
+					for (int c = 0; c < RENDER_AOVS; c++)
+						planes[c * numPixels + p] = values[c];
+				}
+			out.WriteTile(tx, ty, planes);
+		}
+		delete[] planes;
+	}
+	return out.Close();
+}
+
+Vec3 Render::shade(Ray &ray, HitRec &rec, int shader, int thread)
+{
+	Vec3 color(0.0f, 0.0f, 0.0f);
+	if (rec.id != -1)
+	{
+		switch (shader)
+		{
+		case 1:
+			color = shade_debug_normal(ray, rec);
+			break;
+		case 2:
+			color = shade_debug_uv(ray, rec);
+			break;
+		case 3:
+			color = shade_debug_miplevel(ray, rec);
+			break;
+		case 4:
+			color = shade_noshading(ray, rec);
+			break;
+		case 5:
+			color = shade_simple(ray, rec);
+			break;
+		case 6:
+			color = shade_path(ray, rec, 0, thread);
+			break;
+		case 7:
+			color = shade_ambient(ray, rec);
+			break;
+		default:
+			color = shade_noshading(ray, rec);
+			break;
+		}
+	}
+	else if (scene->environment != NULL)
+	{
+		// The background is filtered over the footprint of the pixel.
+		color = scene->getEnvironment(ray.dir,
+				scene->environmentLevel(ray.coneSpread));
+	}
+	return color;
+}
+
+/// Spread angle added to the ray cone at a diffuse bounce (heuristic for the width of the lobe).
+#define DIFFUSE_CONE_SPREAD 0.3f
+
+/**
+ * Multiple importance sampling weight of a sample (power heuristic, beta = 2).
+ * @param pdf Density of the strategy that generated the sample.
+ * @param otherPdf Density of the other strategy for the same direction.
+ * @returns Weight in [0, 1].
+ */
+static inline float power_heuristic(const float pdf, const float otherPdf)
+{
+	float a = pdf * pdf;
+	float b = otherPdf * otherPdf;
+	return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
 
-# define MIP_DISTANCE_CONSTANT 0.025
-float Render::getMipLevel(float distance)
+float Render::getMipLevel(const Ray &ray, const HitRec &rec,
+		const Vec3 &normal, const Texture *tex)
 {
 	// TODO 5.4 d) Calculate the mip level from the given distance and use the result for the getTextureColor(...) calls.
-	return log2(distance * MIP_DISTANCE_CONSTANT);
-//	return 0;
+	if (!tex)
+		return 0.0f;
+
+	float width = fabsf(ray.coneWidthAt(rec.dist));
+	float cosine = fabsf(normal * ray.dir);
+	cosine = cosine > 1e-4f ? cosine : 1e-4f;
+
+	float level = scene->uv_lod[rec.id]
+			+ 0.5f * log2f((float) tex->ResX * (float) tex->ResY)
+			+ log2f(width / cosine);
+	return level > 0.0f ? level : 0.0f;
 }
 
 Vec3 Render::shade_debug_normal(Ray &ray, HitRec &rec)
@@ -134,7 +293,9 @@ Vec3 Render::shade_debug_uv(Ray &ray, HitRec &rec)
 
 Vec3 Render::shade_debug_miplevel(Ray &ray, HitRec &rec)
 {
-	int level = (int)getMipLevel(rec.dist);
+	Material &mat = scene->material[scene->mat_index[rec.id]];
+	Vec3 normal = scene->getShadingNormal(ray, rec.id);
+	int level = (int) getMipLevel(ray, rec, normal, mat.tex);
 
 	Vec3 color(0.0f);
 	color[level % 3] = 1.0f;
@@ -145,13 +306,16 @@ Vec3 Render::shade_debug_miplevel(Ray &ray, HitRec &rec)
 
 Vec3 Render::shade_noshading(Ray &ray, HitRec &rec)
 {
-	Vec3 color(scene->material[scene->mat_index[rec.id]].color_d);
+	Material &mat = scene->material[scene->mat_index[rec.id]];
+	Vec3 color(mat.color_d);
 
 	// TODO 5.3 b) Multiply color with the texture color by calling Material::getTextureColor(coords).
 	Vec2 coords = scene->getTextureCoordinates(ray, rec.id);
+	Vec3 normal = scene->getShadingNormal(ray, rec.id);
 
 	// TODO 5.4 d) Add the second parameter to Material::getTextureColor(...).
-	Vec3 tex_color = scene->material->GetTextureColor(coords, getMipLevel(rec.dist));
+	Vec3 tex_color = mat.GetTextureColor(coords,
+			getMipLevel(ray, rec, normal, mat.tex));
 
 	return Vec3::product(color, tex_color);
 
@@ -161,15 +325,24 @@ Vec3 Render::shade_noshading(Ray &ray, HitRec &rec)
 
 Vec3 Render::shade_simple(Ray &ray, HitRec &rec)
 {
+	Material &mat = scene->material[scene->mat_index[rec.id]];
 	Vec3 normal = scene->getShadingNormal(ray, rec.id);
 	float cos = fabsf(normal * ray.dir);
 	Vec3 color = cos;// * scene->material[scene->mat_index[rec.id]].color_d;
+	// With an environment map the surface is lit by it instead of the camera.
+	if (scene->environment)
+	{
+		if (normal * ray.dir > 0.0f)
+			normal *= -1.0f;
+		color = scene->getIrradiance(normal);
+	}
 
 	// TODO 5.3 b) Multiply color with the texture color by calling Material::getTextureColor(coords).
 	Vec2 coords = scene->getTextureCoordinates(ray, rec.id);
 
 	// TODO 5.4 d) Add the second parameter to Material::getTextureColor(...).
-	Vec3 tex_color = scene->material->GetTextureColor(coords, getMipLevel(rec.dist));
+	Vec3 tex_color = mat.GetTextureColor(coords,
+			getMipLevel(ray, rec, normal, mat.tex));
 
 	return Vec3::product(color, tex_color);
 
@@ -177,6 +350,20 @@ Vec3 Render::shade_simple(Ray &ray, HitRec &rec)
 
 }
 
+Vec3 Render::shade_ambient(Ray &ray, HitRec &rec)
+{
+	Material &mat = scene->material[scene->mat_index[rec.id]];
+	Vec3 normal = scene->getShadingNormal(ray, rec.id);
+	if (normal * ray.dir > 0.0f)
+		normal *= -1.0f;
+
+	Vec2 coords = scene->getTextureCoordinates(ray, rec.id);
+	Vec3 albedo = Vec3::product(mat.color_d,
+			mat.GetTextureColor(coords, getMipLevel(ray, rec, normal, mat.tex)));
+
+	return mat.color_e + Vec3::product(albedo, scene->getIrradiance(normal));
+}
+
 Vec3 Render::shade_path(Ray &ray, HitRec &rec, int depth, int thread)
 {
 	if (depth > 5)
@@ -197,6 +384,9 @@ Vec3 Render::shade_path(Ray &ray, HitRec &rec, int depth, int thread)
 			mtrand[thread]->rand());
 	newRay.tmin = RAY_EPS;
 	newRay.tmax = RAY_MAX;
+	// The cone continues from its footprint and widens by the diffuse lobe.
+	newRay.coneWidth = ray.coneWidthAt(rec.dist);
+	newRay.coneSpread = ray.coneSpread + DIFFUSE_CONE_SPREAD;
 
 	Vec3 color = mat.color_d;
 
@@ -204,15 +394,48 @@ Vec3 Render::shade_path(Ray &ray, HitRec &rec, int depth, int thread)
 	Vec2 coords = scene->getTextureCoordinates(ray, rec.id);
 
 	// TODO 5.4 d) Add the second parameter to Material::getTextureColor(...).
-	Vec3 tex_color = scene->material->GetTextureColor(coords, getMipLevel(rec.dist));
+	Vec3 tex_color = mat.GetTextureColor(coords,
+			getMipLevel(ray, rec, hitNormal, mat.tex));
 	color = Vec3::product(color, tex_color);
 
 
+	Vec3 incoming = sample_environment(newRay.origin, hitNormal, thread);
+
 	HitRec newRec = accel->intersect(newRay);
 	if (newRec.id == -1)
-		return Vec3::product(color, scene->getEnvironment(newRay.dir));
+	{
+		float bouncePdf = (hitNormal * newRay.dir) * (float) M_1_PI;
+		float envPdf = scene->environmentPdf(newRay.dir);
+		incoming += scene->getEnvironment(newRay.dir)
+				* power_heuristic(bouncePdf, envPdf);
+	}
+	else
+		incoming += shade_path(newRay, newRec, depth + 1, thread);
+
+	return Vec3::product(color, incoming);
+}
+
+Vec3 Render::sample_environment(const Vec3 &origin, const Vec3 &normal,
+		int thread)
+{
+	if (scene->env_dist == 0)
+		return Vec3(0.0f);
+
+	Vec3 dir;
+	float envPdf;
+	Vec3 radiance = scene->sampleEnvironment(dir, envPdf,
+			mtrand[thread]->randExc(), mtrand[thread]->randExc());
+	float cosine = normal * dir;
+	if (envPdf <= 0.0f || cosine <= 0.0f)
+		return Vec3(0.0f);
+
+	Ray shadow(origin, dir, RAY_EPS, RAY_MAX);
+	if (accel->intersect(shadow).id != -1)
+		return Vec3(0.0f);
 
-	return Vec3::product(color, shade_path(newRay, newRec, depth + 1, thread));
+	float bouncePdf = cosine * (float) M_1_PI;
+	return radiance
+			* (bouncePdf / envPdf * power_heuristic(envPdf, bouncePdf));
 }
 
 inline void Render::shrink_accum(float &inv_accum, float &shrink)
@@ -14,6 +14,7 @@
 #include "scene.h"
 #include "cam.h"
 #include "material.h"
+#include "denoise.h"
 
 /**
  * Renderer
@@ -44,6 +45,17 @@ struct Render
 	/// Number of pictures that have been accumulated in image.
 	int accum_index;
 
+	/// Shading normals of the primary hits, facing the camera.
+	Vec3 *guide_normal;
+	/// Diffuse colors of the primary hits.
+	Vec3 *guide_albedo;
+	/// Distances of the primary hits, 0 for misses.
+	float *guide_depth;
+	/// Denoised image, updated by denoise().
+	Vec3 *denoised;
+	/// Denoiser with its scratch buffers, created by the first denoise().
+	Denoiser *denoiser;
+
 	/**
 	 * Initializes the scene completely according to a given scene.
 	 */
@@ -62,13 +74,50 @@ struct Render
 	void render(int shader);
 
 	/**
-	 * Calculates the mip level for a certain distance.
-	 * @remarks does not adapt to different texture sizes in world space.
-	 * @param distance Distance from the ray origin to the texture.
-	 * @returns Estimate which is at least proportional to the real mip level that
-	 * should be choosen.
+	 * Denoises image into denoised, guided by guide_normal, guide_albedo and
+	 * guide_depth.
+	 * @remarks The primary rays go through the pixel centers, so the guides
+	 * are noise free; render() updates them when the accumulation restarts.
+	 */
+	void denoise();
+
+	/**
+	 * Renders spp samples per pixel tile by tile into a .aov file with the
+	 * layers beauty (R, G, B), normal, albedo, depth (distance of the first
+	 * hit, 0 for misses), samples (samples taken) and variance (of the mean
+	 * beauty). Every tile is written as soon as it is finished.
+	 * @remarks Independent of image and accum_index.
+	 * @param file Path of the file to write.
+	 * @param shader Shader to use, see render().
+	 * @param spp Samples per pixel. Pixels whose color does not depend on
+	 * random numbers get one.
+	 * @returns True if the file was written completely.
+	 */
+	bool renderAov(const char *file, int shader, int spp);
+
+	/**
+	 * Shades the first hit of a primary ray or the background for misses.
+	 * @param ray Primary ray.
+	 * @param rec Result of intersecting ray with the scene.
+	 * @param shader Shader to use, see render().
+	 * @param thread Thread id used for choosing the right Twister in mtrand.
+	 * @returns Color of the pixel sample.
 	 */
-	inline float getMipLevel(float distance);
+	inline Vec3 shade(Ray &ray, HitRec &rec, int shader, int thread);
+
+	/**
+	 * Calculates the mip level of a hit from the footprint of the ray cone.
+	 * @remarks Uses the ray cone LOD of Akenine-Moeller et al.: the cone
+	 * width at the hit, the surface slope and the texel density of the hit
+	 * triangle (Scene::uv_lod and the texture resolution).
+	 * @param ray Ray that hits the surface.
+	 * @param rec Defines where the ray hits the scene. Must be a valid hit!
+	 * @param normal Surface normal at the hit.
+	 * @param tex Texture to be sampled, may be 0.
+	 * @returns Mip level (>= 0) to sample tex with.
+	 */
+	inline float getMipLevel(const Ray &ray, const HitRec &rec,
+			const Vec3 &normal, const Texture *tex);
 
 	/** Returns the surface normal as shade.
 	 * @param Ray along which the the shading has to be calculated.
@@ -102,10 +151,19 @@ struct Render
 	/** Calculates the shading with simple smooth shading.
 	 * @param Ray along which the the shading has to be calculated.
 	 * @param Defines where the ray hits the scene. Must be a valid hit!
-	 * @returns Diffuse surface as lit by the camera.
+	 * @returns Diffuse surface as lit by the camera, or by the prefiltered
+	 * environment if the scene has an environment map.
 	 */
 	inline Vec3 shade_simple(Ray &ray, HitRec &rec);
 
+	/** Calculates the shading of a diffuse surface lit by the prefiltered
+	 * environment (Scene::getIrradiance) without shadows.
+	 * @param Ray along which the the shading has to be calculated.
+	 * @param Defines where the ray hits the scene. Must be a valid hit!
+	 * @returns Emitted plus ambient reflected light.
+	 */
+	inline Vec3 shade_ambient(Ray &ray, HitRec &rec);
+
 	/** Recursively calculates the shading with a path tracer which
 	 * incorporates indirect light.
 	 * @param Ray along which the the shading has to be calculated.
@@ -117,6 +175,20 @@ struct Render
 	 */
 	inline Vec3 shade_path(Ray &ray, HitRec &rec, int depth, int thread);
 
+	/**
+	 * Estimates the light arriving directly from the environment map at a
+	 * diffuse surface by sampling Scene::env_dist.
+	 * @remarks Weighted with the power heuristic against the cosine
+	 * distributed bounce of shade_path, which weights its own environment
+	 * hits accordingly.
+	 * @param origin Surface point.
+	 * @param normal Normal of the surface facing the incoming ray.
+	 * @param thread Thread id used for choosing the right Twister in mtrand.
+	 * @returns Incoming radiance times cosine / pi, without the albedo.
+	 */
+	inline Vec3 sample_environment(const Vec3 &origin, const Vec3 &normal,
+			int thread);
+
 	/**
 	 * Updates the accum_index.
 	 * @param inv_accom Output parameter: Contribution of one single rendering to image.
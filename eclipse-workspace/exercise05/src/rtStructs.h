@@ -39,6 +39,13 @@ struct Ray
 	float tmin;
 	/// Maximum distance for intersection (inclusive).
 	float tmax;
+	/**
+	 * Width of the ray cone at the origin. Together with coneSpread it
+	 * describes the footprint of the ray, used for texture LOD selection.
+	 */
+	float coneWidth;
+	/// Spread angle of the ray cone in radians.
+	float coneSpread;
 
 	/**
 	 * Standard constructor which does not initialize the ray.
@@ -53,11 +60,25 @@ struct Ray
 	 * @param dir See dir.
 	 * @param tmin See tmin.
 	 * @param tmax See tmax.
+	 * @param coneWidth See coneWidth.
+	 * @param coneSpread See coneSpread.
 	 */
 	inline Ray(const Vec3 &origin, const Vec3 &dir, const float tmin,
-			const float tmax) :
-			origin(origin), dir(dir), tmin(tmin), tmax(tmax)
+			const float tmax, const float coneWidth = 0.0f,
+			const float coneSpread = 0.0f) :
+			origin(origin), dir(dir), tmin(tmin), tmax(tmax), coneWidth(
+					coneWidth), coneSpread(coneSpread)
+	{
+	}
+
+	/**
+	 * Calculates the width of the ray cone at a given distance.
+	 * @param t Distance along the ray.
+	 * @returns Width of the footprint at t.
+	 */
+	inline float coneWidthAt(const float t) const
 	{
+		return coneWidth + coneSpread * t;
 	}
 };
 
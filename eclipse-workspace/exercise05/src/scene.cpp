@@ -15,6 +15,15 @@
 
 using namespace std;
 
+/// Texel formats of loaded textures, see SConstruct option "bc".
+#ifdef TEXTURE_BC
+#define LDR_TEXTURE_FORMAT FORMAT_BC1
+#define HDR_TEXTURE_FORMAT FORMAT_BC_HDR
+#else
+#define LDR_TEXTURE_FORMAT FORMAT_RGBA8
+#define HDR_TEXTURE_FORMAT FORMAT_RGBE
+#endif
+
 Scene::Scene(const char* sceneFile, const char* envFile)
 {
 	LoadScn(sceneFile);
@@ -26,10 +35,15 @@ Scene::~Scene()
 	delete[] triangles;
 	delete[] normals;
 	delete[] uv;
+	delete[] uv_lod;
 	delete[] material;
 	delete[] mat_index;
 	if (environment != 0)
-		delete[] environment;
+		delete environment;
+	if (env_dist != 0)
+		delete env_dist;
+	if (env_irradiance != 0)
+		delete env_irradiance;
 	delete[] cam;
 }
 
@@ -62,6 +76,7 @@ bool Scene::LoadScn(const char * file)
 	normals = (Vec3*) norms;
 	load_float_data(uvFilename.c_str(), uvs);
 	uv = (Vec2*) uvs;
+	ComputeTextureLOD();
 
 	mat_index = new int[num_tris];
 
@@ -103,10 +118,32 @@ bool Scene::LoadScn(const char * file)
 			if(line.size() > 10)
 			{
 				sscanf(line.c_str(), "%*s %s", texPath);
-				int resX, resY;
-				float *image;
-				load_image_ppm(texPath, image, resX, resY);
-				mat.tex = new Texture(resX, resY, (Vec3*)image);
+				int len = strlen(texPath);
+				if (len > 4 && strcmp(texPath + len - 4, ".ttx") == 0)
+				{
+					// Out-of-core texture, tiles are streamed while rendering.
+					TiledTextureFile *file = new TiledTextureFile(texPath);
+					if (file->fd >= 0)
+						mat.tex = new Texture(file);
+					else
+					{
+						std::cerr << "Could not open texture " << texPath << std::endl;
+						delete file;
+						mat.tex = 0;
+					}
+				}
+				else
+				{
+					int resX, resY;
+					float *image;
+					if (load_image_ppm(texPath, image, resX, resY))
+						mat.tex = new Texture(resX, resY, (Vec3*)image, LDR_TEXTURE_FORMAT);
+					else
+					{
+						std::cerr << "Could not read texture " << texPath << std::endl;
+						mat.tex = 0;
+					}
+				}
 			}
 			else
 				mat.tex = 0;
@@ -128,18 +165,224 @@ bool Scene::LoadScn(const char * file)
 	return true;
 }
 
+void Scene::ComputeTextureLOD()
+{
+	uv_lod = new float[num_tris];
+	for (int t = 0; t < num_tris; t++)
+	{
+		const Triangle &tri = triangles[t];
+		float worldArea = Vec3::cross(tri.v[1] - tri.v[0], tri.v[2] - tri.v[0]).length();
+		Vec2 e1 = uv[t * 3 + 1] - uv[t * 3];
+		Vec2 e2 = uv[t * 3 + 2] - uv[t * 3];
+		float uvArea = fabsf(e1.x * e2.y - e1.y * e2.x);
+
+		// Degenerate mappings get the finest level.
+		if (worldArea > 0.0f && uvArea > 0.0f)
+			uv_lod[t] = 0.5f * log2f(uvArea / worldArea);
+		else
+			uv_lod[t] = -FLT_MAX;
+	}
+}
+
 bool Scene::LoadEnv(const char * file)
 {
 	environment = 0;
+	env_dist = 0;
+	env_irradiance = 0;
 
 	if (file == 0)
 		return false;
 
 	float *data;
 
-	bool success = load_image_hdr(file, data, env_x, env_y);
-	environment = (Vec3*) data;
+	if (!load_image_hdr(file, data, env_x, env_y))
+		return false;
+	// By default RGBE keeps the .hdr data lossless at a third of the size of
+	// floats. FORMAT_RGB16F is an alternative with more precision in dark channels.
+	environment = new Texture(env_x, env_y, (Vec3*) data, HDR_TEXTURE_FORMAT);
+	BuildEnvironmentDistribution();
+	BuildIrradiance();
+
+	return true;
+}
+
+/// Edge length of Scene::env_irradiance in texels.
+#define IRRADIANCE_RES 32
+/// Maximum edge length of the mip level of the environment that is convolved.
+#define IRRADIANCE_SOURCE_RES 64
+
+void Scene::BuildIrradiance()
+{
+	// The cosine lobe is so wide that a coarse level loses nothing visible.
+	int level = 0;
+	while (level + 1 < environment->MipLevels
+			&& (environment->MipResX(level) > IRRADIANCE_SOURCE_RES
+					|| environment->MipResY(level) > IRRADIANCE_SOURCE_RES))
+		level++;
+	int srcX = environment->MipResX(level);
+	int srcY = environment->MipResY(level);
+
+	// Radiance times solid angle of every source texel.
+	int numSrc = srcX * srcY;
+	Vec3 *srcDir = new Vec3[numSrc];
+	Vec3 *srcFlux = new Vec3[numSrc];
+	for (int y = 0; y < srcY; y++)
+		for (int x = 0; x < srcX; x++)
+		{
+			Vec3 d = environmentDirection((x + 0.5f) / srcX, (y + 0.5f) / srcY);
+			srcDir[y * srcX + x] = d;
+			srcFlux[y * srcX + x] = environment->Texel(level, x, y)
+					* (environmentJacobian(d) / (float) numSrc);
+		}
+
+	Vec3 *irradiance = new Vec3[IRRADIANCE_RES * IRRADIANCE_RES];
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int y = 0; y < IRRADIANCE_RES; y++)
+		for (int x = 0; x < IRRADIANCE_RES; x++)
+		{
+			Vec3 n = environmentDirection((x + 0.5f) / IRRADIANCE_RES,
+					(y + 0.5f) / IRRADIANCE_RES);
+			Vec3 sum(0.0f);
+			for (int i = 0; i < numSrc; i++)
+			{
+				float cosine = n * srcDir[i];
+				if (cosine > 0.0f)
+					sum += srcFlux[i] * cosine;
+			}
+			irradiance[y * IRRADIANCE_RES + x] = sum * (float) M_1_PI;
+		}
+	delete[] srcDir;
+	delete[] srcFlux;
+
+	env_irradiance = new Texture(IRRADIANCE_RES, IRRADIANCE_RES, irradiance,
+			FORMAT_RGB32F, LAYOUT_LINEAR);
+}
+
+Vec3 Scene::sampleOctahedral(const Texture *map, const Vec3 &d,
+		const int level)
+{
+	int resX = map->MipResX(level);
+	int resY = map->MipResY(level);
+	float u, v;
+	environmentCoords(d, u, v);
+
+	float cx = u * (float) resX - 0.5f;
+	float cy = v * (float) resY - 0.5f;
+	int x0 = (int) floorf(cx);
+	int y0 = (int) floorf(cy);
+	float rel_x = cx - (float) x0;
+	float rel_y = cy - (float) y0;
+
+	Vec3 t[4];
+	for (int i = 0; i < 4; i++)
+	{
+		int x = x0 + (i & 1);
+		int y = y0 + (i >> 1);
+		// Crossing an edge of the map continues on the mirrored side.
+		if (x < 0 || x >= resX)
+		{
+			x = x < 0 ? -1 - x : 2 * resX - 1 - x;
+			y = resY - 1 - y;
+		}
+		if (y < 0 || y >= resY)
+		{
+			y = y < 0 ? -1 - y : 2 * resY - 1 - y;
+			x = resX - 1 - x;
+		}
+		x = x < 0 ? 0 : (x < resX ? x : resX - 1);
+		y = y < 0 ? 0 : (y < resY ? y : resY - 1);
+		t[i] = map->Texel(level, x, y);
+	}
+	return (t[0] * (1 - rel_x) + t[1] * rel_x) * (1 - rel_y)
+			+ (t[2] * (1 - rel_x) + t[3] * rel_x) * rel_y;
+}
+
+Vec3 Scene::getEnvironment(const Vec3 &d, float level) const
+{
+	if (environment == 0)
+		return Vec3(0.0f);
+
+	level = level > 0.0f ? level : 0.0f;
+	if (level >= (float) (environment->MipLevels - 1))
+		return sampleOctahedral(environment, d, environment->MipLevels - 1);
+
+	int l_low = (int) level;
+	float rel = level - (float) l_low;
+	Vec3 color = sampleOctahedral(environment, d, l_low);
+	if (rel > 0.0f)
+		color = color * (1 - rel)
+				+ sampleOctahedral(environment, d, l_low + 1) * rel;
+	return color;
+}
+
+float Scene::environmentLevel(const float spread) const
+{
+	if (environment == 0 || spread <= 0.0f)
+		return 0.0f;
+
+	// A texel of level 0 covers 4 pi / (env_x * env_y) steradians on average.
+	float texelAngle = sqrtf(4.0f * (float) M_PI / (float) (env_x * env_y));
+	float level = log2f(spread / texelAngle);
+	return level > 0.0f ? level : 0.0f;
+}
+
+Vec3 Scene::getIrradiance(const Vec3 &n) const
+{
+	if (env_irradiance == 0)
+		return Vec3(0.0f);
+	return sampleOctahedral(env_irradiance, n, 0);
+}
+
+void Scene::BuildEnvironmentDistribution()
+{
+	// Weights are taken from the stored texels, so they match getEnvironment.
+	float *weights = new float[env_x * env_y];
+	for (int y = 0; y < env_y; y++)
+		for (int x = 0; x < env_x; x++)
+		{
+			Vec3 c = environment->Texel(0, x, y);
+			float luminance = 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+			Vec3 d = environmentDirection((x + 0.5f) / env_x, (y + 0.5f) / env_y);
+			weights[y * env_x + x] = luminance * environmentJacobian(d);
+		}
+	env_dist = new AliasTable(weights, env_x * env_y);
+	delete[] weights;
+}
+
+Vec3 Scene::sampleEnvironment(Vec3 &dir, float &pdf, const double u0,
+		const float u1) const
+{
+	if (env_dist == 0)
+	{
+		pdf = 0.0f;
+		return Vec3(0.0f);
+	}
+
+	float rest;
+	int i = env_dist->Sample(u0, rest);
+	int x = i % env_x;
+	int y = i / env_x;
+	dir = environmentDirection((x + rest) / env_x, (y + u1) / env_y);
+
+	// Uniform inside the texel: density pdf[i] * env_x * env_y in (u, v).
+	pdf = env_dist->pdf[i] * (float) (env_x * env_y) / environmentJacobian(dir);
+	return environment->Texel(0, x, y);
+}
+
+float Scene::environmentPdf(const Vec3 &d) const
+{
+	if (env_dist == 0)
+		return 0.0f;
 
-	return success;
+	float u, v;
+	environmentCoords(d, u, v);
+	int x = (int) (u * (float) env_x);
+	int y = (int) (v * (float) env_y);
+	x = x < env_x ? x : env_x - 1;
+	y = y < env_y ? y : env_y - 1;
+	return env_dist->pdf[y * env_x + x] * (float) (env_x * env_y)
+			/ environmentJacobian(d);
 }
 
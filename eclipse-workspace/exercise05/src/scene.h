@@ -9,6 +9,7 @@
 #include "material.h"
 #include "cam.h"
 #include "rtStructs.h"
+#include "utils/alias.h"
 #include <iostream>
 
 /**
@@ -28,6 +29,11 @@ struct Scene
 	 * uv[t*3 + n] contains the nth texture coordinates of the tth triangle.
 	 */
 	Vec2 * uv;
+	/**
+	 * Texture LOD constant of every triangle.
+	 * uv_lod[t] contains 0.5 * log2(uv area / world space area) of the tth triangle.
+	 */
+	float * uv_lod;
 	/// Number of triangles in the scene.
 	int num_tris;
 
@@ -41,12 +47,23 @@ struct Scene
 	 */
 	int * mat_index;
 
-	/// Environment map of the scene.
-	Vec3 * environment;
+	/// Environment map of the scene, stored as FORMAT_RGBE texture.
+	Texture * environment;
 	/// Width of the environment map in pixels.
 	int env_x;
 	/// Height of the environment map in pixels.
 	int env_y;
+	/**
+	 * Distribution over the texels of the environment map proportional to
+	 * luminance times solid angle, 0 if there is no environment map.
+	 */
+	AliasTable * env_dist;
+	/**
+	 * Octahedral map of the environment convolved with a clamped cosine,
+	 * i.e. the radiance reflected by a white diffuse surface with a given
+	 * normal (without occlusion). 0 if there is no environment map.
+	 */
+	Texture * env_irradiance;
 
 	/// Camera that will be used for rendering.
 	Cam * cam;
@@ -71,6 +88,18 @@ struct Scene
 	 * May be NULL if no environment map should be loaded.
 	 */
 	bool LoadEnv(const char * file);
+	/**
+	 * Calculates uv_lod from triangles and uv.
+	 */
+	void ComputeTextureLOD();
+	/**
+	 * Builds env_dist from environment.
+	 */
+	void BuildEnvironmentDistribution();
+	/**
+	 * Builds env_irradiance from a coarse mip level of environment.
+	 */
+	void BuildIrradiance();
 
 	/**
 	 * Retrieves a smooth shading normal from the scene.
@@ -92,6 +121,78 @@ struct Scene
 	 * @returns HDR environment map color for the given direction.
 	 */
 	Vec3 getEnvironment(const Vec3 &d) const;
+	/**
+	 * Retrieves the filtered environment color for a given direction.
+	 * @param d Ray direction.
+	 * @param level Mip level, fractional levels are interpolated (trilinear).
+	 * @returns HDR environment map color for the given direction.
+	 */
+	Vec3 getEnvironment(const Vec3 &d, float level) const;
+	/**
+	 * Calculates the mip level of the environment map that matches the
+	 * footprint of a ray cone.
+	 * @param spread Spread angle of the cone in radians.
+	 * @returns Mip level (>= 0).
+	 */
+	float environmentLevel(const float spread) const;
+	/**
+	 * Retrieves the light reflected by a white diffuse surface that is lit
+	 * by the whole environment, see env_irradiance.
+	 * @param n Surface normal.
+	 * @returns Reflected radiance, (0, 0, 0) if there is no environment map.
+	 */
+	Vec3 getIrradiance(const Vec3 &n) const;
+	/**
+	 * Bilinearly samples a mip level of an octahedral map.
+	 * @remarks Neighbours across the border of the map are taken from the
+	 * mirrored position, which is where the octahedron continues.
+	 * @param map Square octahedral map.
+	 * @param d Direction.
+	 * @param level Mip level.
+	 * @returns Interpolated color.
+	 */
+	static Vec3 sampleOctahedral(const Texture *map, const Vec3 &d,
+			const int level);
+	/**
+	 * Maps a direction to coordinates of the octahedral environment map.
+	 * @param d Direction, does not need to be normalized.
+	 * @param u Out parameter: Horizontal coordinate in [0, 1].
+	 * @param v Out parameter: Vertical coordinate in [0, 1].
+	 */
+	static void environmentCoords(const Vec3 &d, float &u, float &v);
+	/**
+	 * Maps coordinates of the octahedral environment map to a direction.
+	 * @remarks Inverse of environmentCoords.
+	 * @param u Horizontal coordinate in [0, 1].
+	 * @param v Vertical coordinate in [0, 1].
+	 * @returns Normalized direction.
+	 */
+	static Vec3 environmentDirection(const float u, const float v);
+	/**
+	 * Calculates the solid angle covered by a unit area of environment map
+	 * coordinates around a direction.
+	 * @param d Normalized direction.
+	 * @returns Jacobian d(solid angle) / d(u, v).
+	 */
+	static float environmentJacobian(const Vec3 &d);
+	/**
+	 * Samples a direction of the environment map proportional to its luminance.
+	 * @param dir Out parameter: Sampled normalized direction.
+	 * @param pdf Out parameter: Solid angle density of dir, 0 if there is
+	 * no environment map.
+	 * @param u0 Uniform random number in [0, 1).
+	 * @param u1 Uniform random number in [0, 1).
+	 * @returns HDR environment map color in direction dir.
+	 */
+	Vec3 sampleEnvironment(Vec3 &dir, float &pdf, const double u0,
+			const float u1) const;
+	/**
+	 * Calculates the solid angle density with which sampleEnvironment
+	 * generates a direction.
+	 * @param d Normalized direction.
+	 * @returns Density, 0 if there is no environment map.
+	 */
+	float environmentPdf(const Vec3 &d) const;
 };
 
 inline Vec3 Scene::getShadingNormal(const Ray &ray, const int tri_id) const
@@ -125,11 +226,8 @@ inline float sign(float a)
 		return -1.0f;
 }
 
-inline Vec3 Scene::getEnvironment(const Vec3 &drot90) const
+inline void Scene::environmentCoords(const Vec3 &drot90, float &u, float &v)
 {
-	if (environment == 0)
-		return Vec3(0.0f);
-
 	Vec3 d(drot90.x, -drot90.z, drot90.y);
 
 	float inv_sum = 1.0f / (fabs(d[0]) + fabs(d[1]) + fabs(d[2]));
@@ -137,7 +235,6 @@ inline Vec3 Scene::getEnvironment(const Vec3 &drot90) const
 	float py = d[1] * inv_sum;
 	float pz = d[2] * inv_sum;
 
-	float u, v;
 	if (pz >= 0.0f)
 	{
 		u = px * 0.5f + 0.5f;
@@ -148,6 +245,42 @@ inline Vec3 Scene::getEnvironment(const Vec3 &drot90) const
 		u = sign(px) * (1.0f - fabs(py)) * 0.5f + 0.5f;
 		v = sign(py) * (1.0f - fabs(px)) * 0.5f + 0.5f;
 	}
+}
+
+inline Vec3 Scene::environmentDirection(const float u, const float v)
+{
+	float px = u * 2.0f - 1.0f;
+	float py = v * 2.0f - 1.0f;
+	float pz = 1.0f - fabs(px) - fabs(py);
+	if (pz < 0.0f)
+	{
+		float fx = sign(px) * (1.0f - fabs(py));
+		float fy = sign(py) * (1.0f - fabs(px));
+		px = fx;
+		py = fy;
+	}
+	// Undo the rotation of environmentCoords.
+	Vec3 d(px, pz, -py);
+	d.normalize();
+	return d;
+}
+
+inline float Scene::environmentJacobian(const Vec3 &d)
+{
+	// A point p = d / |d|_1 of the octahedron unfolded to (px, py) in
+	// [-1, 1]^2 covers d(solid angle) = dpx dpy / |p|^3 (the folding of the
+	// lower half preserves area), and dpx dpy = 4 du dv.
+	float l1 = fabs(d.x) + fabs(d.y) + fabs(d.z);
+	return 4.0f * l1 * l1 * l1;
+}
+
+inline Vec3 Scene::getEnvironment(const Vec3 &drot90) const
+{
+	if (environment == 0)
+		return Vec3(0.0f);
+
+	float u, v;
+	environmentCoords(drot90, u, v);
 	int x = (int) (u * (float) env_x);
 	int y = (int) (v * (float) env_y);
 
@@ -156,7 +289,7 @@ inline Vec3 Scene::getEnvironment(const Vec3 &drot90) const
 	y = y > 0 ? y : 0;
 	y = y < env_y ? y : env_y - 1;
 
-	return environment[x + y * env_x];
+	return environment->Texel(0, x, y);
 }
 
 #endif
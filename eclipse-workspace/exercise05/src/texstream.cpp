@@ -0,0 +1,430 @@
+/**
+ * Out-of-core textures, see texstream.h.
+ */
+
+#include "texstream.h"
+#include "material.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char TTX_MAGIC[4] = { 'T', 'T', 'X', '1' };
+
+/// Whether a TexelFormat read from a file is one save_texture_ttx() writes.
+static bool ttx_format(int format)
+{
+	switch (format)
+	{
+	case FORMAT_RGB32F:
+	case FORMAT_RGBA8_SRGB:
+	case FORMAT_RGB16F:
+	case FORMAT_RGBE:
+	case FORMAT_RGBA8:
+		return true;
+	default:
+		return false;
+	}
+}
+
+TiledTextureFile::TiledTextureFile(const char *file) :
+		fd(-1), firstTile(0), offsets(0), readFailed(false)
+{
+	path = new char[strlen(file) + 1];
+	strcpy(path, file);
+
+	int f = open(file, O_RDONLY);
+	if (f < 0)
+		return;
+
+	char magic[4];
+	int header[5];
+	long fileSize = lseek(f, 0, SEEK_END);
+	if (pread(f, magic, 4, 0) != 4 || memcmp(magic, TTX_MAGIC, 4) != 0
+			|| pread(f, header, sizeof(header), 4) != sizeof(header)
+			|| header[0] <= 0 || header[1] <= 0 || header[4] != TTX_TILE
+			|| !ttx_format(header[3]))
+	{
+		close(f);
+		return;
+	}
+	ResX = header[0];
+	ResY = header[1];
+	MipLevels = header[2];
+	format = header[3];
+	texelBytes = Texture::TexelBytes((TexelFormat) format);
+
+	// At most one level per halving of the larger side, down to 1x1.
+	int maxLevels = 1;
+	for (int res = ResX > ResY ? ResX : ResY; res > 1; res /= 2)
+		maxLevels++;
+	if (MipLevels < 1 || MipLevels > maxLevels)
+	{
+		close(f);
+		return;
+	}
+
+	// The offset table has to fit into the file, which also bounds the
+	// memory allocated for it by the file size.
+	const long tableStart = 4 + sizeof(header);
+	long numTiles = 0;
+	for (int l = 0; l < MipLevels; l++)
+	{
+		int tilesY = (MipResY(l) + TTX_TILE - 1) / TTX_TILE;
+		numTiles += (long) TilesX(l) * tilesY;
+		if (numTiles > (fileSize - tableStart) / (long) sizeof(long))
+		{
+			close(f);
+			return;
+		}
+	}
+
+	firstTile = new int[MipLevels + 1];
+	firstTile[0] = 0;
+	for (int l = 0; l < MipLevels; l++)
+	{
+		int tilesY = (MipResY(l) + TTX_TILE - 1) / TTX_TILE;
+		firstTile[l + 1] = firstTile[l] + TilesX(l) * tilesY;
+	}
+
+	offsets = new long[numTiles];
+	long size = numTiles * sizeof(long);
+	bool valid = pread(f, offsets, size, tableStart) == size;
+	for (int l = 0; valid && l < MipLevels; l++)
+		for (int t = firstTile[l]; valid && t < firstTile[l + 1]; t++)
+			valid = offsets[t] >= tableStart + size
+					&& offsets[t] <= fileSize - TileBytes(l);
+	if (!valid)
+	{
+		close(f);
+		return;
+	}
+	fd = f;
+}
+
+TiledTextureFile::~TiledTextureFile()
+{
+	if (fd >= 0)
+		close(fd);
+	delete[] path;
+	delete[] firstTile;
+	delete[] offsets;
+}
+
+int TiledTextureFile::MipResX(int level) const
+{
+	int res = ResX >> level;
+	return res > 0 ? res : 1;
+}
+
+int TiledTextureFile::MipResY(int level) const
+{
+	int res = ResY >> level;
+	return res > 0 ? res : 1;
+}
+
+int TiledTextureFile::TileResX(int level) const
+{
+	return MipResX(level) < TTX_TILE ? MipResX(level) : TTX_TILE;
+}
+
+int TiledTextureFile::TilesX(int level) const
+{
+	return (MipResX(level) + TTX_TILE - 1) / TTX_TILE;
+}
+
+int TiledTextureFile::TileBytes(int level) const
+{
+	int tileResY = MipResY(level) < TTX_TILE ? MipResY(level) : TTX_TILE;
+	return TileResX(level) * tileResY * texelBytes;
+}
+
+bool TiledTextureFile::ReadTile(int level, int tile, unsigned char *out) const
+{
+	int bytes = TileBytes(level);
+	return pread(fd, out, bytes, offsets[firstTile[level] + tile]) == bytes;
+}
+
+/// Mixes the bits of a cache key for shard and bucket selection.
+static inline unsigned long long hash_key(unsigned long long key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+TileCache::TileCache(long budget)
+{
+	for (int s = 0; s < TTX_CACHE_SHARDS; s++)
+	{
+		TileCacheShard &shard = shards[s];
+		pthread_mutex_init(&shard.lock, 0);
+		pthread_cond_init(&shard.loaded, 0);
+		shard.numBuckets = 4096;
+		shard.buckets = new TileCacheEntry*[shard.numBuckets];
+		memset(shard.buckets, 0, shard.numBuckets * sizeof(TileCacheEntry*));
+		shard.head = shard.tail = 0;
+		shard.bytes = 0;
+		shard.budget = budget / TTX_CACHE_SHARDS;
+		shard.hits = shard.misses = shard.evictions = 0;
+	}
+}
+
+TileCache::~TileCache()
+{
+	for (int s = 0; s < TTX_CACHE_SHARDS; s++)
+	{
+		TileCacheShard &shard = shards[s];
+		TileCacheEntry *e = shard.head;
+		while (e)
+		{
+			TileCacheEntry *next = e->next;
+			delete[] e->texels;
+			delete e;
+			e = next;
+		}
+		delete[] shard.buckets;
+		pthread_cond_destroy(&shard.loaded);
+		pthread_mutex_destroy(&shard.lock);
+	}
+}
+
+/// Removes an entry from the LRU list of its shard.
+static void lru_unlink(TileCacheShard &shard, TileCacheEntry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		shard.head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		shard.tail = e->prev;
+}
+
+/// Inserts an entry as most recently used.
+static void lru_push_front(TileCacheShard &shard, TileCacheEntry *e)
+{
+	e->prev = 0;
+	e->next = shard.head;
+	if (shard.head)
+		shard.head->prev = e;
+	shard.head = e;
+	if (!shard.tail)
+		shard.tail = e;
+}
+
+/// Removes an entry from its hash bucket, the LRU list and the byte count.
+static void shard_remove(TileCacheShard &shard, TileCacheEntry *e)
+{
+	int b = (hash_key(e->key) / TTX_CACHE_SHARDS) % shard.numBuckets;
+	TileCacheEntry **link = &shard.buckets[b];
+	while (*link != e)
+		link = &(*link)->bucketNext;
+	*link = e->bucketNext;
+
+	lru_unlink(shard, e);
+	shard.bytes -= e->bytes;
+}
+
+/// Evicts least recently used unpinned entries until the shard fits its budget.
+static void evict(TileCacheShard &shard)
+{
+	TileCacheEntry *e = shard.tail;
+	while (e && shard.bytes > shard.budget)
+	{
+		TileCacheEntry *prev = e->prev;
+		if (e->pins == 0)
+		{
+			shard_remove(shard, e);
+			shard.evictions++;
+			delete[] e->texels;
+			delete e;
+		}
+		e = prev;
+	}
+}
+
+/// Reports the first failed tile read of a file on std::cerr.
+static void report_read_error(const TiledTextureFile *file)
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutex_lock(&lock);
+	if (!file->readFailed)
+	{
+		file->readFailed = true;
+		std::cerr << "Could not read tiles of " << file->path
+				<< ", they are sampled as black" << std::endl;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+TileCacheEntry* TileCache::Acquire(const TiledTextureFile *file, int serial,
+		int level, int tile)
+{
+	unsigned long long key = ((unsigned long long) serial << 40)
+			| ((unsigned long long) level << 32) | (unsigned int) tile;
+	unsigned long long h = hash_key(key);
+	TileCacheShard &shard = shards[h % TTX_CACHE_SHARDS];
+
+	pthread_mutex_lock(&shard.lock);
+
+	int b = (h / TTX_CACHE_SHARDS) % shard.numBuckets;
+	TileCacheEntry *e;
+	for (;;)
+	{
+		e = shard.buckets[b];
+		while (e && e->key != key)
+			e = e->bucketNext;
+		if (!e || !e->loading)
+			break;
+		// Another thread reads the tile. The entry may be gone after the
+		// wait if that read failed, so it is looked up again.
+		pthread_cond_wait(&shard.loaded, &shard.lock);
+	}
+
+	if (e)
+	{
+		shard.hits++;
+		lru_unlink(shard, e);
+		lru_push_front(shard, e);
+		e->pins++;
+		evict(shard);
+		pthread_mutex_unlock(&shard.lock);
+		return e;
+	}
+
+	// Fault the tile in. The entry is inserted as loading and pinned, so it
+	// is neither read twice nor evicted while the shard is unlocked for
+	// the read.
+	shard.misses++;
+	e = new TileCacheEntry;
+	e->key = key;
+	e->bytes = file->TileBytes(level);
+	e->texels = new unsigned char[e->bytes];
+	e->pins = 1;
+	e->cached = true;
+	e->loading = true;
+	e->bucketNext = shard.buckets[b];
+	shard.buckets[b] = e;
+	shard.bytes += e->bytes;
+	lru_push_front(shard, e);
+	evict(shard);
+	pthread_mutex_unlock(&shard.lock);
+
+	bool read = file->ReadTile(level, tile, e->texels);
+
+	pthread_mutex_lock(&shard.lock);
+	e->loading = false;
+	if (!read)
+	{
+		// Handed out zeroed but not cached, so the next request reads again.
+		shard_remove(shard, e);
+		e->cached = false;
+	}
+	pthread_cond_broadcast(&shard.loaded);
+	pthread_mutex_unlock(&shard.lock);
+
+	if (!read)
+	{
+		memset(e->texels, 0, e->bytes);
+		report_read_error(file);
+	}
+	return e;
+}
+
+void TileCache::Release(TileCacheEntry *entry)
+{
+	if (!entry->cached)
+	{
+		delete[] entry->texels;
+		delete entry;
+		return;
+	}
+	TileCacheShard &shard = shards[hash_key(entry->key) % TTX_CACHE_SHARDS];
+	pthread_mutex_lock(&shard.lock);
+	entry->pins--;
+	pthread_mutex_unlock(&shard.lock);
+}
+
+void TileCache::PrintStats() const
+{
+	long hits = 0, misses = 0, evictions = 0, bytes = 0;
+	for (int s = 0; s < TTX_CACHE_SHARDS; s++)
+	{
+		hits += shards[s].hits;
+		misses += shards[s].misses;
+		evictions += shards[s].evictions;
+		bytes += shards[s].bytes;
+	}
+	long total = hits + misses;
+	if (total == 0)
+		return;
+	std::cout << "Tile cache: " << hits << " hits, " << misses << " misses ("
+			<< (total ? 100.0 * misses / total : 0.0) << "%), " << evictions
+			<< " evictions, " << bytes / 1024 << " KB resident" << std::endl;
+}
+
+TileCache& TileCache::Global()
+{
+	static TileCache cache((long) TEX_CACHE_MB * 1024 * 1024);
+	return cache;
+}
+
+bool save_texture_ttx(const char *file, const Texture &tex)
+{
+	if (tex.blockBytes || tex.stream)
+		return false;
+
+	FILE *out = fopen(file, "wb");
+	if (!out)
+		return false;
+
+	int header[5] = { tex.ResX, tex.ResY, tex.MipLevels, tex.format, TTX_TILE };
+	bool success = fwrite(TTX_MAGIC, 4, 1, out) == 1
+			&& fwrite(header, sizeof(header), 1, out) == 1;
+
+	int numTiles = 0;
+	for (int l = 0; l < tex.MipLevels; l++)
+		numTiles += ((tex.MipResX(l) + TTX_TILE - 1) / TTX_TILE)
+				* ((tex.MipResY(l) + TTX_TILE - 1) / TTX_TILE);
+	long *offsets = new long[numTiles];
+	long offset = 4 + sizeof(header) + numTiles * sizeof(long);
+	success = success && fseek(out, offset, SEEK_SET) == 0;
+
+	int t = 0;
+	for (int l = 0; success && l < tex.MipLevels; l++)
+	{
+		int resX = tex.MipResX(l);
+		int resY = tex.MipResY(l);
+		int tileResX = resX < TTX_TILE ? resX : TTX_TILE;
+		int tileResY = resY < TTX_TILE ? resY : TTX_TILE;
+		int bytes = tileResX * tileResY * tex.texelBytes;
+		unsigned char *tile = new unsigned char[bytes];
+
+		for (int ty = 0; success && ty * TTX_TILE < resY; ty++)
+			for (int tx = 0; success && tx * TTX_TILE < resX; tx++)
+			{
+				memset(tile, 0, bytes);
+				for (int j = 0; j < tileResY && ty * TTX_TILE + j < resY; j++)
+					for (int i = 0; i < tileResX && tx * TTX_TILE + i < resX; i++)
+						tex.EncodeTexel(tile + (j * tileResX + i) * tex.texelBytes,
+								tex.Texel(l, tx * TTX_TILE + i, ty * TTX_TILE + j));
+				offsets[t++] = offset;
+				success = fwrite(tile, bytes, 1, out) == 1;
+				offset += bytes;
+			}
+		delete[] tile;
+	}
+
+	success = success && fseek(out, 4 + sizeof(header), SEEK_SET) == 0
+			&& fwrite(offsets, sizeof(long), numTiles, out) == (size_t) numTiles;
+	success = fclose(out) == 0 && success;
+	delete[] offsets;
+	// Do not leave a truncated file behind, e.g. when the disk is full.
+	if (!success)
+		remove(file);
+	return success;
+}
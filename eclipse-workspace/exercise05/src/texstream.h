@@ -0,0 +1,185 @@
+/**
+ * Out-of-core textures: a tiled on-disk texture format (.ttx) and a
+ * fixed-budget tile cache with LRU eviction that streams tiles on demand.
+ */
+
+#ifndef TEXSTREAM_H
+#define TEXSTREAM_H
+
+#include <pthread.h>
+
+/// Edge length of a tile of a .ttx file in texels.
+#define TTX_TILE 64
+/// Number of independently locked shards of the TileCache.
+#define TTX_CACHE_SHARDS 16
+/// Default budget of the global tile cache in MB, see SConstruct option "texcache".
+#ifndef TEX_CACHE_MB
+#define TEX_CACHE_MB 256
+#endif
+
+/**
+ * Open .ttx file.
+ *
+ * File layout (little endian):
+ *   char[4] "TTX1"
+ *   int     ResX, ResY, MipLevels, TexelFormat, TTX_TILE
+ *   long    offset[number of tiles of all levels]
+ *   tiles, level by level, row by row. A tile of level l holds
+ *   min(TTX_TILE, MipResX(l)) x min(TTX_TILE, MipResY(l)) encoded texels
+ *   row by row, partial tiles at the border are padded.
+ */
+struct TiledTextureFile
+{
+	/// File descriptor, read with pread so all threads can share it.
+	int fd;
+	/// Path of the file, used to reopen it for copies of a Texture.
+	char *path;
+	/// Width of mip level 0 in texels.
+	int ResX;
+	/// Height of mip level 0 in texels.
+	int ResY;
+	/// Number of mip levels stored in the file.
+	int MipLevels;
+	/// TexelFormat of the stored texels.
+	int format;
+	/// Size of one encoded texel in bytes.
+	int texelBytes;
+	/// Index of the first tile of every mip level in offsets.
+	int *firstTile;
+	/// File offset of every tile.
+	long *offsets;
+	/// Whether a failed tile read was reported already, see TileCache::Acquire().
+	mutable bool readFailed;
+
+	/**
+	 * Opens a .ttx file and reads its header.
+	 * @remarks Files with an invalid header, a block compressed or unknown
+	 * format or tiles outside the file are rejected.
+	 * @param file Path of the file. Check fd >= 0 for success.
+	 */
+	TiledTextureFile(const char *file);
+	~TiledTextureFile();
+
+	/// Width of a mip level in texels (at least 1).
+	int MipResX(int level) const;
+	/// Height of a mip level in texels (at least 1).
+	int MipResY(int level) const;
+	/// Width of the tiles of a mip level in texels.
+	int TileResX(int level) const;
+	/// Number of tiles in one row of a mip level.
+	int TilesX(int level) const;
+	/// Size of one tile of a mip level in bytes.
+	int TileBytes(int level) const;
+
+	/**
+	 * Reads one tile from disk.
+	 * @param level Mip level.
+	 * @param tile Index of the tile inside the level.
+	 * @param out Out parameter: TileBytes(level) bytes.
+	 * @returns False on read errors.
+	 */
+	bool ReadTile(int level, int tile, unsigned char *out) const;
+};
+
+/**
+ * Entry of the TileCache.
+ */
+struct TileCacheEntry
+{
+	/// Key built from texture serial, level and tile index.
+	unsigned long long key;
+	/// Encoded texels of the tile.
+	unsigned char *texels;
+	/// Size of texels in bytes.
+	int bytes;
+	/// Number of users that currently read texels; pinned entries are not evicted.
+	int pins;
+	/// False for a zeroed stand-in of a tile that could not be read. It is
+	/// not part of the cache and is deleted by TileCache::Release().
+	bool cached;
+	/// True while the tile is read from disk; texels are not valid yet.
+	bool loading;
+	/// Neighbours in the LRU list of the shard (prev is more recently used).
+	TileCacheEntry *prev, *next;
+	/// Next entry in the same hash bucket.
+	TileCacheEntry *bucketNext;
+};
+
+/**
+ * One independently locked part of the TileCache.
+ */
+struct TileCacheShard
+{
+	pthread_mutex_t lock;
+	/// Signaled whenever an entry of this shard finished loading.
+	pthread_cond_t loaded;
+	/// Hash buckets of the entries.
+	TileCacheEntry **buckets;
+	int numBuckets;
+	/// Most and least recently used entries.
+	TileCacheEntry *head, *tail;
+	/// Bytes of tile data currently held and allowed in this shard.
+	long bytes, budget;
+	/// Statistics.
+	long hits, misses, evictions;
+};
+
+/**
+ * Thread safe cache of texture tiles with a fixed memory budget.
+ * Tiles are faulted in from their TiledTextureFile on a miss and the
+ * least recently used unpinned tiles are evicted when the budget is exceeded.
+ * The shard of a missing tile is not locked while the tile is read, only
+ * threads that request the same tile wait for the read.
+ */
+struct TileCache
+{
+	TileCacheShard shards[TTX_CACHE_SHARDS];
+
+	/**
+	 * Initializes an empty cache.
+	 * @param budget Maximum number of bytes of tile data.
+	 */
+	TileCache(long budget);
+	~TileCache();
+
+	/**
+	 * Returns a tile and pins it until Release() is called.
+	 * @param file File to read the tile from on a miss.
+	 * @param serial Texture::serial of the texture the tile belongs to.
+	 * @param level Mip level.
+	 * @param tile Index of the tile inside the level.
+	 * @returns Pinned entry, its texels stay valid until Release(). If the
+	 * tile cannot be read, the texels are zero and the failure is reported
+	 * once per file on std::cerr; the tile is read again on the next request.
+	 */
+	TileCacheEntry* Acquire(const TiledTextureFile *file, int serial, int level,
+			int tile);
+
+	/**
+	 * Unpins a tile returned by Acquire().
+	 */
+	void Release(TileCacheEntry *entry);
+
+	/**
+	 * Prints hit, miss and eviction statistics to std::cout.
+	 * @remarks Prints nothing if no tile was ever requested.
+	 */
+	void PrintStats() const;
+
+	/**
+	 * Returns the cache shared by all streamed textures (TEX_CACHE_MB budget).
+	 */
+	static TileCache& Global();
+};
+
+struct Texture;
+
+/**
+ * Writes a texture with a per texel format to a .ttx file.
+ * @param file Path of the file to write.
+ * @param tex Texture, must not use a block compressed format.
+ * @returns True on success. On write errors the partial file is removed.
+ */
+bool save_texture_ttx(const char *file, const Texture &tex);
+
+#endif
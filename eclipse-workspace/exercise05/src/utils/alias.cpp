@@ -0,0 +1,70 @@
+/**
+ * Walker alias table, see alias.h.
+ */
+
+#include "alias.h"
+
+AliasTable::AliasTable(const float *weights, const int n) :
+		n(n)
+{
+	prob = new float[n];
+	alias = new int[n];
+	pdf = new float[n];
+
+	total = 0.0;
+	for (int i = 0; i < n; i++)
+		total += weights[i];
+
+	// Vose's method: entries are split into those below and above the
+	// average weight, each small entry is topped up by a large one.
+	int *small = new int[n];
+	int *large = new int[n];
+	int numSmall = 0, numLarge = 0;
+	double *scaled = new double[n];
+	for (int i = 0; i < n; i++)
+	{
+		pdf[i] = total > 0.0 ? (float) (weights[i] / total) : 1.0f / n;
+		scaled[i] = total > 0.0 ? weights[i] * n / total : 1.0;
+		if (scaled[i] < 1.0)
+			small[numSmall++] = i;
+		else
+			large[numLarge++] = i;
+	}
+
+	while (numSmall > 0 && numLarge > 0)
+	{
+		int s = small[--numSmall];
+		int l = large[--numLarge];
+		prob[s] = (float) scaled[s];
+		alias[s] = l;
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if (scaled[l] < 1.0)
+			small[numSmall++] = l;
+		else
+			large[numLarge++] = l;
+	}
+	// Leftovers are 1 up to rounding errors.
+	while (numLarge > 0)
+	{
+		int l = large[--numLarge];
+		prob[l] = 1.0f;
+		alias[l] = l;
+	}
+	while (numSmall > 0)
+	{
+		int s = small[--numSmall];
+		prob[s] = 1.0f;
+		alias[s] = s;
+	}
+
+	delete[] small;
+	delete[] large;
+	delete[] scaled;
+}
+
+AliasTable::~AliasTable()
+{
+	delete[] prob;
+	delete[] alias;
+	delete[] pdf;
+}
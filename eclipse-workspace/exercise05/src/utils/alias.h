@@ -0,0 +1,62 @@
+/**
+ * Walker alias table for sampling discrete distributions in O(1).
+ */
+
+#ifndef ALIAS_H
+#define ALIAS_H
+
+/**
+ * Discrete distribution over n entries, built from non negative weights.
+ */
+struct AliasTable
+{
+	/// Number of entries.
+	int n;
+	/// Probability to keep entry i when it is drawn, scaled to [0, 1].
+	float *prob;
+	/// Entry that is taken instead of i otherwise.
+	int *alias;
+	/// Normalized probability of every entry.
+	float *pdf;
+	/// Sum of all weights the table was built from.
+	double total;
+
+	/**
+	 * Builds the table.
+	 * @remarks If all weights are 0 every entry gets the same probability.
+	 * @param weights n non negative weights.
+	 * @param n Number of weights.
+	 */
+	AliasTable(const float *weights, const int n);
+	~AliasTable();
+
+	/**
+	 * Draws an entry.
+	 * @remarks u is scaled in double, so rest keeps about 32 - log2(n) bits
+	 * of u instead of the 24 - log2(n) bits of a float.
+	 * @param u Uniform random number in [0, 1).
+	 * @param rest Out parameter: Uniform random number in [0, 1) which is
+	 * still unused, so a single number suffices for the entry and a jitter.
+	 * @returns Index of the entry, pdf[index] is its probability.
+	 */
+	inline int Sample(double u, float &rest) const
+	{
+		double scaled = u * n;
+		int i = (int) scaled;
+		i = i < n ? (i < 0 ? 0 : i) : n - 1;
+		double v = scaled - i;
+		int entry = i;
+		if (prob[i] >= 1.0f || v < prob[i])
+			v /= prob[i];
+		else
+		{
+			v = (v - prob[i]) / (1.0 - prob[i]);
+			entry = alias[i];
+		}
+		// Below 1 also if u was rounded up to 1 or v is rounded to float.
+		rest = v < 0.99999994 ? (float) v : 0.99999994f;
+		return entry;
+	}
+};
+
+#endif
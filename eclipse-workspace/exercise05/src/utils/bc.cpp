@@ -0,0 +1,280 @@
+/**
+ * Block compression of 4x4 texel blocks, see bc.h.
+ */
+
+#include "bc.h"
+#include "texel.h"
+#include <cmath>
+#include <cfloat>
+
+/// Clamps v to [min, max].
+static inline float bc_clamp(const float v, const float min, const float max)
+{
+	return v >= min ? (v <= max ? v : max) : min;
+}
+
+/**
+ * Calculates the mean and the principal axis of a set of colors.
+ * @param mean Out parameter: Mean color.
+ * @param axis Out parameter: Normalized direction of the largest variance,
+ * (0, 0, 0) if all colors are equal.
+ * @param c Colors.
+ * @param n Number of colors.
+ */
+static void principal_axis(Vec3 &mean, Vec3 &axis, const Vec3 *c, const int n)
+{
+	mean = Vec3(0.0f);
+	for (int i = 0; i < n; i++)
+		mean += c[i];
+	mean /= (float) n;
+
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < n; i++)
+	{
+		Vec3 d = c[i] - mean;
+		cov[0] += d.x * d.x;
+		cov[1] += d.x * d.y;
+		cov[2] += d.x * d.z;
+		cov[3] += d.y * d.y;
+		cov[4] += d.y * d.z;
+		cov[5] += d.z * d.z;
+	}
+
+	// Power iteration, started from the axis with the largest variance.
+	axis = Vec3(0.0f);
+	if (cov[0] >= cov[3] && cov[0] >= cov[5])
+		axis.x = 1.0f;
+	else if (cov[3] >= cov[5])
+		axis.y = 1.0f;
+	else
+		axis.z = 1.0f;
+	for (int it = 0; it < 8; it++)
+	{
+		Vec3 a(cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z,
+				cov[1] * axis.x + cov[3] * axis.y + cov[4] * axis.z,
+				cov[2] * axis.x + cov[4] * axis.y + cov[5] * axis.z);
+		float l = a.length();
+		if (l < 1e-20f)
+		{
+			axis = Vec3(0.0f);
+			return;
+		}
+		axis = a / l;
+	}
+}
+
+/**
+ * Calculates two endpoints that span the colors along their principal axis.
+ * @param e0 Out parameter: Endpoint at the minimum projection.
+ * @param e1 Out parameter: Endpoint at the maximum projection.
+ * @param c 16 colors.
+ */
+static void block_endpoints(Vec3 &e0, Vec3 &e1, const Vec3 c[16])
+{
+	Vec3 mean, axis;
+	principal_axis(mean, axis, c, 16);
+
+	float tmin = 0.0f, tmax = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (c[i] - mean) * axis;
+		tmin = t < tmin ? t : tmin;
+		tmax = t > tmax ? t : tmax;
+	}
+	e0 = mean + axis * tmin;
+	e1 = mean + axis * tmax;
+}
+
+/// Expands a RGB565 color to 8 bit per channel like the hardware does.
+static void unpack565(int rgb[3], unsigned short c)
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+/// Quantizes a color in [0, 1] to RGB565.
+static unsigned short pack565(const Vec3 &c)
+{
+	int r = (int) (bc_clamp(c.x, 0.0f, 1.0f) * 31.0f + 0.5f);
+	int g = (int) (bc_clamp(c.y, 0.0f, 1.0f) * 63.0f + 0.5f);
+	int b = (int) (bc_clamp(c.z, 0.0f, 1.0f) * 31.0f + 0.5f);
+	return (unsigned short) ((r << 11) | (g << 5) | b);
+}
+
+/// Builds the 8 bit palette of a BC1 block from its endpoints.
+static void bc1_palette(int pal[4][3], unsigned short c0, unsigned short c1)
+{
+	unpack565(pal[0], c0);
+	unpack565(pal[1], c1);
+	for (int k = 0; k < 3; k++)
+	{
+		if (c0 > c1)
+		{
+			pal[2][k] = (2 * pal[0][k] + pal[1][k]) / 3;
+			pal[3][k] = (pal[0][k] + 2 * pal[1][k]) / 3;
+		}
+		else
+		{
+			pal[2][k] = (pal[0][k] + pal[1][k]) / 2;
+			pal[3][k] = 0;
+		}
+	}
+}
+
+void bc1_encode_block(unsigned char *out, const Vec3 texels[16])
+{
+	// Endpoints are fitted in sRGB space, which is where they are stored.
+	Vec3 s[16];
+	for (int i = 0; i < 16; i++)
+		for (int k = 0; k < 3; k++)
+			s[i][k] = linear2srgb(bc_clamp(texels[i][k], 0.0f, 1.0f));
+
+	Vec3 e0, e1;
+	block_endpoints(e0, e1, s);
+	unsigned short c0 = pack565(e1);
+	unsigned short c1 = pack565(e0);
+	if (c0 < c1)
+	{
+		unsigned short tmp = c0;
+		c0 = c1;
+		c1 = tmp;
+	}
+
+	int pal[4][3];
+	bc1_palette(pal, c0, c1);
+
+	unsigned int indices = 0;
+	// With c0 == c1 the block is in 3 color mode, index 0 is exact then.
+	if (c0 != c1)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			float bestDist = FLT_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				float dist = 0.0f;
+				for (int k = 0; k < 3; k++)
+				{
+					float d = s[i][k] * 255.0f - (float) pal[p][k];
+					dist += d * d;
+				}
+				if (dist < bestDist)
+				{
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= best << (2 * i);
+		}
+	}
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	for (int b = 0; b < 4; b++)
+		out[4 + b] = (indices >> (8 * b)) & 0xff;
+}
+
+void bc1_decode_block(Vec3 texels[16], const unsigned char *in,
+		const float *srgbTable)
+{
+	unsigned short c0 = in[0] | (in[1] << 8);
+	unsigned short c1 = in[2] | (in[3] << 8);
+	unsigned int indices = in[4] | (in[5] << 8) | (in[6] << 16)
+			| ((unsigned int) in[7] << 24);
+
+	int pal[4][3];
+	bc1_palette(pal, c0, c1);
+	Vec3 colors[4];
+	for (int p = 0; p < 4; p++)
+		colors[p] = Vec3(srgbTable[pal[p][0]], srgbTable[pal[p][1]],
+				srgbTable[pal[p][2]]);
+
+	for (int i = 0; i < 16; i++)
+		texels[i] = colors[(indices >> (2 * i)) & 3];
+}
+
+unsigned int float2rgb9e5(const Vec3 &c)
+{
+	// See GL_EXT_texture_shared_exponent: 9 bit mantissas, bias 15.
+	const float maxValue = 511.0f / 512.0f * 65536.0f;
+	float r = bc_clamp(c.x, 0.0f, maxValue);
+	float g = bc_clamp(c.y, 0.0f, maxValue);
+	float b = bc_clamp(c.z, 0.0f, maxValue);
+	float maxc = fmaxf(r, fmaxf(g, b));
+	if (maxc <= 0.0f)
+		return 0;
+
+	int exp = (int) floorf(log2f(maxc));
+	exp = exp < -16 ? -16 : exp;
+	exp += 1 + 15;
+	float scale = ldexpf(1.0f, exp - 15 - 9);
+	if ((int) floorf(maxc / scale + 0.5f) == 512)
+	{
+		exp++;
+		scale *= 2.0f;
+	}
+
+	unsigned int rm = (unsigned int) floorf(r / scale + 0.5f);
+	unsigned int gm = (unsigned int) floorf(g / scale + 0.5f);
+	unsigned int bm = (unsigned int) floorf(b / scale + 0.5f);
+	return rm | (gm << 9) | (bm << 18) | ((unsigned int) exp << 27);
+}
+
+Vec3 rgb9e52float(unsigned int v)
+{
+	float scale = ldexpf(1.0f, (int) (v >> 27) - 15 - 9);
+	return Vec3((v & 511) * scale, ((v >> 9) & 511) * scale,
+			((v >> 18) & 511) * scale);
+}
+
+void bc_hdr_encode_block(unsigned char *out, const Vec3 texels[16])
+{
+	Vec3 e0, e1;
+	block_endpoints(e0, e1, texels);
+	unsigned int q0 = float2rgb9e5(e0);
+	unsigned int q1 = float2rgb9e5(e1);
+
+	// Indices are chosen against the quantized endpoints.
+	Vec3 p0 = rgb9e52float(q0);
+	Vec3 d = rgb9e52float(q1) - p0;
+	float len2 = d * d;
+
+	unsigned char idx[16];
+	for (int i = 0; i < 16; i++)
+	{
+		float t = len2 > 0.0f ? ((texels[i] - p0) * d) / len2 : 0.0f;
+		int k = (int) (t * 15.0f + 0.5f);
+		idx[i] = (unsigned char) (k < 0 ? 0 : (k > 15 ? 15 : k));
+	}
+
+	for (int b = 0; b < 4; b++)
+	{
+		out[b] = (q0 >> (8 * b)) & 0xff;
+		out[4 + b] = (q1 >> (8 * b)) & 0xff;
+	}
+	for (int b = 0; b < 8; b++)
+		out[8 + b] = idx[2 * b] | (idx[2 * b + 1] << 4);
+}
+
+void bc_hdr_decode_block(Vec3 texels[16], const unsigned char *in)
+{
+	unsigned int q0 = in[0] | (in[1] << 8) | (in[2] << 16)
+			| ((unsigned int) in[3] << 24);
+	unsigned int q1 = in[4] | (in[5] << 8) | (in[6] << 16)
+			| ((unsigned int) in[7] << 24);
+	Vec3 p0 = rgb9e52float(q0);
+	Vec3 d = (rgb9e52float(q1) - p0) / 15.0f;
+
+	for (int b = 0; b < 8; b++)
+	{
+		texels[2 * b] = p0 + d * (float) (in[8 + b] & 15);
+		texels[2 * b + 1] = p0 + d * (float) (in[8 + b] >> 4);
+	}
+}
@@ -0,0 +1,67 @@
+/**
+ * Block compression of 4x4 texel blocks.
+ *
+ * BC1: Standard BC1/DXT1 layout (8 bytes per block). Two RGB565 endpoints
+ * and 2 bit indices into a 4 color palette. The endpoints are sRGB encoded,
+ * the decoder interpolates in 8 bit and converts to linear through a LUT.
+ *
+ * BC_HDR: Simplified BC6H-like HDR layout (16 bytes per block). Two RGB9E5
+ * shared exponent endpoints and 4 bit indices into a 16 color palette
+ * which is interpolated linearly in float.
+ */
+
+#ifndef BC_H
+#define BC_H
+
+#include "vec.h"
+
+/// Size of an encoded BC1 block in bytes.
+#define BC1_BLOCK_BYTES 8
+/// Size of an encoded BC_HDR block in bytes.
+#define BC_HDR_BLOCK_BYTES 16
+
+/**
+ * Encodes a 4x4 block of linear LDR colors as BC1.
+ * @param out Out parameter: BC1_BLOCK_BYTES bytes.
+ * @param texels 16 colors in [0, 1], row by row.
+ */
+void bc1_encode_block(unsigned char *out, const Vec3 texels[16]);
+
+/**
+ * Decodes a BC1 block.
+ * @param texels Out parameter: 16 linear colors, row by row.
+ * @param in BC1_BLOCK_BYTES bytes.
+ * @param srgbTable srgb8_table() from utils/texel.h.
+ */
+void bc1_decode_block(Vec3 texels[16], const unsigned char *in,
+		const float *srgbTable);
+
+/**
+ * Encodes a 4x4 block of HDR colors as BC_HDR.
+ * @param out Out parameter: BC_HDR_BLOCK_BYTES bytes.
+ * @param texels 16 non negative colors, row by row.
+ */
+void bc_hdr_encode_block(unsigned char *out, const Vec3 texels[16]);
+
+/**
+ * Decodes a BC_HDR block.
+ * @param texels Out parameter: 16 colors, row by row.
+ * @param in BC_HDR_BLOCK_BYTES bytes.
+ */
+void bc_hdr_decode_block(Vec3 texels[16], const unsigned char *in);
+
+/**
+ * Encodes a color with 9 bit mantissas and a shared 5 bit exponent.
+ * @param c Non negative color.
+ * @returns Packed RGB9E5 value.
+ */
+unsigned int float2rgb9e5(const Vec3 &c);
+
+/**
+ * Decodes an RGB9E5 value.
+ * @param v Packed RGB9E5 value.
+ * @returns Decoded color.
+ */
+Vec3 rgb9e52float(unsigned int v);
+
+#endif
@@ -7,80 +7,295 @@
 #include "rgbe.h"
 #include <iostream>
 #include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <unistd.h>
+#include "texel.h"
 
-void save_image_ppm(const char * file, float * image, const int ResX, const int ResY) {
-  FILE *out = fopen(file, "wb");
-  if ( out ) {
-    // convert to unsigned chars
-    const unsigned int size = ResX * ResY * 3;
-    unsigned char *buffer_c = new unsigned char[size];
-    for ( int j = 0; j < ResY; j++ ) {
-      for ( int i = 0; i < ResX * 3; i++ ) {
-        float tmp = image[i + (ResY - j - 1) * ResX * 3] * 255.f;
-        buffer_c[i + j * ResX * 3] = tmp < 255.f ? (unsigned char)tmp : 255;
+/**
+ * Reads the magic number and integer fields of a .ppm/.pfm header.
+ * @remarks Fields may be separated by any whitespace and comments. Leaves the
+ * file at the first byte of the pixel data, after the single whitespace
+ * character that ends the header.
+ * @param magic Out parameter: The two magic characters.
+ * @param fields Out parameter: count integer fields.
+ * @param scale Out parameter: The trailing float field of .pfm files, may be 0.
+ */
+static bool read_pnm_header(FILE *in, char magic[2], int *fields, const int count, float *scale) {
+  if ( fread(magic, 1, 2, in) != 2 ) return false;
+
+  const int numTokens = count + (scale ? 1 : 0);
+  for ( int t = 0; t < numTokens; t++ ) {
+    int c = fgetc(in);
+    // skip whitespace and comments
+    while ( c == '#' || isspace(c) ) {
+      if ( c == '#' )
+        while ( c != '\n' && c != EOF ) c = fgetc(in);
+      c = fgetc(in);
+    }
+    char token[64];
+    int len = 0;
+    while ( c != EOF && !isspace(c) && c != '#' && len < 63 ) {
+      token[len++] = (char)c;
+      c = fgetc(in);
+    }
+    token[len] = 0;
+    if ( len == 0 ) return false;
+    // exactly one whitespace character separates the header from the data
+    if ( t == numTokens - 1 && !isspace(c) ) return false;
+    if ( c == '#' ) ungetc(c, in);
+    if ( t < count ) {
+      char *end;
+      fields[t] = (int)strtol(token, &end, 10);
+      if ( *end || fields[t] <= 0 ) return false;
+    }
+    else {
+      char *end;
+      *scale = strtof(token, &end);
+      if ( *end ) return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Lookup table from linear values quantized to 16 bit to encoded 8 bit values.
+ * @returns Table with 65536 entries.
+ */
+static const unsigned char* encoding_table(const ImageEncoding encoding) {
+  static struct Tables {
+    unsigned char gamma[65536];
+    unsigned char srgb[65536];
+    Tables() {
+      for ( int i = 0; i < 65536; i++ ) {
+        float v = i / 65535.0f;
+        gamma[i] = (unsigned char)(powf(v, 1.0f / 2.2f) * 255.0f + 0.5f);
+        srgb[i] = (unsigned char)(linear2srgb(v) * 255.0f + 0.5f);
       }
     }
+  } tables;
+  return encoding == ENCODING_SRGB ? tables.srgb : tables.gamma;
+}
+
+/**
+ * Converts one row of floats to encoded 8 bit values.
+ */
+static void encode_row(unsigned char *out, const float *in, const int n, const ImageEncoding encoding) {
+  if ( encoding == ENCODING_LINEAR ) {
+    // branch free, so the compiler vectorizes it
+    for ( int i = 0; i < n; i++ ) {
+      float v = in[i] * 255.0f + 0.5f;
+      v = v > 0.0f ? v : 0.0f;
+      v = v < 255.0f ? v : 255.0f;
+      out[i] = (unsigned char)(int)v;
+    }
+    return;
+  }
+  const unsigned char *table = encoding_table(encoding);
+  for ( int i = 0; i < n; i++ ) {
+    float v = in[i] * 65535.0f + 0.5f;
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 65535.0f ? v : 65535.0f;
+    out[i] = table[(int)v];
+  }
+}
 
-    fprintf(out, "P6\n%d\n%d\n255\n", ResX, ResY);
-    if ( fwrite(buffer_c, ResX * ResY * 3, 1, out) != 1 ) {
-      std::cout << "Could not write image! " << std::endl;
+void save_image_ppm(const char * file, const float * image, const int ResX, const int ResY,
+    const ImageEncoding encoding) {
+  FILE *out = fopen(file, "wb");
+  if ( !out ) return;
+
+  fprintf(out, "P6\n%d %d\n255\n", ResX, ResY);
+  fflush(out);
+  const long header = ftell(out);
+  const int fd = fileno(out);
+  const int rowBytes = ResX * 3;
+  bool failed = false;
+
+  // Every row is converted into a small per thread buffer and written to
+  // its final position, the file's top row is the image's last row.
+#ifdef OPENMP
+#pragma omp parallel reduction(||:failed)
+#endif
+  {
+    unsigned char *row = new unsigned char[rowBytes];
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
+    for ( int j = 0; j < ResY; j++ ) {
+      encode_row(row, image + (long)(ResY - j - 1) * rowBytes, rowBytes, encoding);
+      if ( pwrite(fd, row, rowBytes, header + (long)j * rowBytes) != rowBytes )
+        failed = true;
     }
-    fclose(out);
-    delete [] buffer_c;
+    delete [] row;
   }
+
+  if ( failed )
+    std::cout << "Could not write image! " << std::endl;
+  fclose(out);
 }
 
-bool load_image_ppm(const char * file, float *&image, int &ResX, int &ResY) {
+bool load_image_ppm(const char * file, float *&image, int &ResX, int &ResY,
+    const ImageEncoding encoding) {
   FILE *in = fopen(file, "rb");
-  if ( in ) {
-    if ( !fscanf(in, "P6\n%d\n%d\n255\n", &ResX, &ResY) ) return false;
-    image = new float[ResX * ResY * 3];
-    unsigned char *buffer_c = new unsigned char[ResX * ResY * 3];
-    if ( fread(buffer_c, ResX * ResY * 3, 1, in) != 1 ) return false;
+  if ( !in ) return false;
+
+  char magic[2];
+  int fields[3];
+  if ( !read_pnm_header(in, magic, fields, 3, 0) || magic[0] != 'P' || magic[1] != '6'
+      || fields[2] > 65535 ) {
+    fclose(in);
+    return false;
+  }
+  ResX = fields[0];
+  ResY = fields[1];
+  const int maxValue = fields[2];
+  const int bytesPerValue = maxValue > 255 ? 2 : 1;
+  const int rowValues = ResX * 3;
+  const int rowBytes = rowValues * bytesPerValue;
+  const long header = ftell(in);
+  const int fd = fileno(in);
+
+  // decoding table for every possible stored value
+  float *table = new float[maxValue + 1];
+  for ( int i = 0; i <= maxValue; i++ ) {
+    float v = (float)i / (float)maxValue;
+    if ( encoding == ENCODING_GAMMA22 ) v = powf(v, 2.2f);
+    else if ( encoding == ENCODING_SRGB ) v = srgb2linear(v);
+    table[i] = v;
+  }
+
+  image = new float[(long)ResX * ResY * 3];
+  bool failed = false;
+#ifdef OPENMP
+#pragma omp parallel reduction(||:failed)
+#endif
+  {
+    unsigned char *row = new unsigned char[rowBytes];
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
     for ( int j = 0; j < ResY; j++ ) {
-      for ( int i = 0; i < ResX * 3; i++ ) {
-        float tmp = (float)buffer_c[i + (ResY - j - 1) * ResX * 3] / 255.0f;
-        image[i + j * ResX * 3] = tmp < 1.0f ? tmp : 1.0f;
+      if ( pread(fd, row, rowBytes, header + (long)j * rowBytes) != rowBytes ) {
+        failed = true;
+        continue;
+      }
+      float *dst = image + (long)(ResY - j - 1) * rowValues;
+      if ( bytesPerValue == 1 ) {
+        for ( int i = 0; i < rowValues; i++ )
+          dst[i] = table[row[i]];
+      }
+      else {
+        // 16 bit values are big endian
+        for ( int i = 0; i < rowValues; i++ ) {
+          int v = (row[2 * i] << 8) | row[2 * i + 1];
+          dst[i] = table[v <= maxValue ? v : maxValue];
+        }
       }
     }
+    delete [] row;
+  }
+  delete [] table;
+  fclose(in);
+
+  if ( failed ) {
+    delete [] image;
+    image = 0;
+    return false;
+  }
+  std::cout << ResX << " " << ResY << std::endl;
+  return true;
+}
+
+void save_image_pfm(const char * file, const float * image, const int ResX, const int ResY) {
+  FILE *out = fopen(file, "wb");
+  if ( !out ) return;
+
+  // a negative scale marks little endian data
+  const unsigned int one = 1;
+  const bool little = *(const unsigned char*)&one == 1;
+  fprintf(out, "PF\n%d %d\n%s\n", ResX, ResY, little ? "-1.0" : "1.0");
+  const size_t count = (size_t)ResX * ResY * 3;
+  if ( fwrite(image, sizeof(float), count, out) != count )
+    std::cout << "Could not write image! " << std::endl;
+  fclose(out);
+}
+
+bool load_image_pfm(const char * file, float *&image, int &ResX, int &ResY) {
+  FILE *in = fopen(file, "rb");
+  if ( !in ) return false;
 
-    std::cout << ResX << " " << ResY << std::endl;
+  char magic[2];
+  int fields[2];
+  float scale = 0.0f;
+  if ( !read_pnm_header(in, magic, fields, 2, &scale) || magic[0] != 'P'
+      || (magic[1] != 'F' && magic[1] != 'f') || scale == 0.0f ) {
     fclose(in);
-    delete buffer_c;
-    return true;
+    return false;
   }
-  return false;
+  ResX = fields[0];
+  ResY = fields[1];
+  const int channels = magic[1] == 'F' ? 3 : 1;
+  const long count = (long)ResX * ResY * channels;
+
+  image = new float[(long)ResX * ResY * 3];
+  // Gray data is read into the last third and expanded in place below.
+  float *data = image + (long)ResX * ResY * 3 - count;
+  if ( fread(data, sizeof(float), count, in) != (size_t)count ) {
+    fclose(in);
+    delete [] image;
+    image = 0;
+    return false;
+  }
+  fclose(in);
+
+  const unsigned int one = 1;
+  const bool little = *(const unsigned char*)&one == 1;
+  if ( (scale < 0.0f) != little ) {
+    unsigned int *words = (unsigned int*)data;
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+    for ( long i = 0; i < count; i++ )
+      words[i] = __builtin_bswap32(words[i]);
+  }
+  if ( channels == 1 )
+    for ( long i = 0; i < (long)ResX * ResY; i++ )
+      image[3 * i] = image[3 * i + 1] = image[3 * i + 2] = data[i];
+
+  return true;
 }
 
 void save_image_hdr(const char * file, float * image, const int ResX, const int ResY) {
   FILE *out_hdr = fopen(file, "wb");
   if ( out_hdr ) {
-    float *buffer_f = new float[ResX * ResY * 3];
-    for ( int j = 0; j < ResY; j++ )
-      for ( int i = 0; i < ResX * 3; i++ )
-        buffer_f[i + j * ResX * 3] = image[i + (ResY - j - 1) * ResX * 3];
+    // the file's first scanline is the image's last row
     RGBE_WriteHeader(out_hdr, ResX, ResY, 0);
-    RGBE_WritePixels_RLE(out_hdr, buffer_f, ResX, ResY);
+    for ( int j = 0; j < ResY; j++ )
+      if ( RGBE_WritePixels_RLE(out_hdr, image + (long)(ResY - j - 1) * ResX * 3, ResX, 1)
+          != RGBE_RETURN_SUCCESS ) break;
     fclose(out_hdr);
-
-    delete [] buffer_f;
   }
 }
 
 bool load_image_hdr(const char * file, float *&image, int &ResX, int &ResY) {
   FILE *in_hdr = fopen(file, "rb");
   if ( in_hdr ) {
-    RGBE_ReadHeader(in_hdr, &ResX, &ResY, 0);
-    image = new float[ResX * ResY * 3];
-    float *buffer_f = new float[ResX * ResY * 3];
-    RGBE_ReadPixels_RLE(in_hdr, buffer_f, ResX, ResY);
-    for ( int j = 0; j < ResY; j++ )
-      for ( int i = 0; i < ResX * 3; i++ )
-        image[i + j * ResX * 3] = buffer_f[i + (ResY - j - 1) * ResX * 3];
+    if ( RGBE_ReadHeader(in_hdr, &ResX, &ResY, 0) != RGBE_RETURN_SUCCESS || ResX <= 0 || ResY <= 0 ) {
+      fclose(in_hdr);
+      return false;
+    }
+    image = new float[(long)ResX * ResY * 3];
+    // scanlines are decoded in parallel straight into their flipped rows
+    bool success = RGBE_ReadPixels_RLE_Parallel(in_hdr, image, ResX, ResY, 1) == RGBE_RETURN_SUCCESS;
     fclose(in_hdr);
-
-    delete [] buffer_f;
-    return true;
+    if ( !success ) {
+      delete [] image;
+      image = 0;
+    }
+    return success;
   }
   return false;
 }
@@ -1,8 +1,51 @@
 #ifndef FILEIO_H
 #define FILEIO_H
 
-void save_image_ppm(const char * file, float * image, const int ResX, const int ResY);
-bool load_image_ppm(const char * file, float *&image, int &ResX, int &ResY);
+/**
+ * Transfer function between the stored 8 bit values of a .ppm file and
+ * the linear floats of an image.
+ */
+enum ImageEncoding {
+  /// Values are stored as they are.
+  ENCODING_LINEAR,
+  /// Power law with gamma 2.2.
+  ENCODING_GAMMA22,
+  /// sRGB transfer function.
+  ENCODING_SRGB
+};
+
+/**
+ * Writes an 8 bit binary .ppm (P6) file.
+ * @remarks Rows are converted and written in parallel straight from image,
+ * values are clamped to [0, 1] and rounded.
+ * @param image RGB floats, the first row is the bottom row of the file.
+ * @param encoding Transfer function applied before quantization.
+ */
+void save_image_ppm(const char * file, const float * image, const int ResX, const int ResY,
+    const ImageEncoding encoding = ENCODING_LINEAR);
+/**
+ * Reads a binary .ppm (P6) file with 8 or 16 bit values.
+ * @remarks The header may contain comments and any whitespace layout.
+ * @param image Out parameter: New RGB floats in [0, 1], the first row is the bottom row of the file.
+ * @param encoding Transfer function that is undone while reading.
+ * @returns False if the file could not be read.
+ */
+bool load_image_ppm(const char * file, float *&image, int &ResX, int &ResY,
+    const ImageEncoding encoding = ENCODING_LINEAR);
+
+/**
+ * Writes a color .pfm (PF) file.
+ * @remarks The rows of a .pfm file run bottom to top like image, so the
+ * framebuffer is written with a single fwrite.
+ * @param image RGB floats, the first row is the bottom row of the file.
+ */
+void save_image_pfm(const char * file, const float * image, const int ResX, const int ResY);
+/**
+ * Reads a color (PF) or grayscale (Pf) .pfm file of either byte order.
+ * @param image Out parameter: New RGB floats, the first row is the bottom row of the file.
+ * @returns False if the file could not be read.
+ */
+bool load_image_pfm(const char * file, float *&image, int &ResX, int &ResY);
 
 void save_image_hdr(const char * file, float * image, const int ResX, const int ResY);
 bool load_image_hdr(const char * file, float *&image, int &ResX, int &ResY);
@@ -7,6 +7,10 @@
 #include <malloc.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* This file contains code to read and write four byte rgbe file format
 developed by Greg Ward.  It handles the conversions between rgbe and
@@ -17,7 +21,9 @@ writing is implemented.  Each routine does error checking and will return
 a status value as defined below.  This code is intended as a skeleton so
 feel free to modify it to suit your needs.
 
-(Place notice here if you modified the code.)
+Modified: batch converters (SSE2), a parallel two pass RLE reader that
+decodes into flipped rows, clamping of negative components and a fix for
+reading past the end of a scanline in RGBE_WriteBytes_RLE.
 posted to http://www.graphics.cornell.edu/~bjw/
 written by Bruce Walter  (bjw@graphics.cornell.edu)  5/26/95
 based on code written by Greg Ward
@@ -72,6 +78,10 @@ float2rgbe(unsigned char rgbe[4], float red, float green, float blue)
 	float v;
 	int e;
 
+	/* negative components are clamped to 0 (modified, see RGBE_FloatToRGBE) */
+	if (red < 0.0f) red = 0.0f;
+	if (green < 0.0f) green = 0.0f;
+	if (blue < 0.0f) blue = 0.0f;
 	v = red;
 	if (green > v) v = green;
 	if (blue > v) v = blue;
@@ -244,8 +254,8 @@ static int RGBE_WriteBytes_RLE(FILE *fp, unsigned char *data, int numbytes)
 			beg_run += run_count;
 			old_run_count = run_count;
 			run_count = 1;
-			while((data[beg_run] == data[beg_run + run_count]) 
-				&& (beg_run + run_count < numbytes) && (run_count < 127))
+			while((beg_run + run_count < numbytes) && (run_count < 127)
+				&& (data[beg_run] == data[beg_run + run_count]))
 				run_count++;
 		}
 		/* if data before next big run is a short run then write it as such */
@@ -291,7 +301,8 @@ int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width,
 	if ((scanline_width < 8)||(scanline_width > 0x7fff))
 		/* run length encoding is not allowed so write flat*/
 		return RGBE_WritePixels(fp,data,scanline_width*num_scanlines);
-	buffer = (unsigned char *)malloc(sizeof(unsigned char)*4*scanline_width);
+	/* second half: interleaved pixels from the batch converter */
+	buffer = (unsigned char *)malloc(sizeof(unsigned char)*8*scanline_width);
 	if (buffer == NULL) 
 		/* no buffer space so write flat */
 		return RGBE_WritePixels(fp,data,scanline_width*num_scanlines);
@@ -304,15 +315,14 @@ int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width,
 			free(buffer);
 			return rgbe_error(rgbe_write_error,NULL);
 		}
+		RGBE_FloatToRGBE(buffer+4*scanline_width,data,scanline_width);
 		for(i=0;i<scanline_width;i++) {
-			float2rgbe(rgbe,data[RGBE_DATA_RED],
-				data[RGBE_DATA_GREEN],data[RGBE_DATA_BLUE]);
-			buffer[i] = rgbe[0];
-			buffer[i+scanline_width] = rgbe[1];
-			buffer[i+2*scanline_width] = rgbe[2];
-			buffer[i+3*scanline_width] = rgbe[3];
-			data += RGBE_DATA_SIZE;
+			buffer[i] = buffer[4*scanline_width+4*i];
+			buffer[i+scanline_width] = buffer[4*scanline_width+4*i+1];
+			buffer[i+2*scanline_width] = buffer[4*scanline_width+4*i+2];
+			buffer[i+3*scanline_width] = buffer[4*scanline_width+4*i+3];
 		}
+		data += RGBE_DATA_SIZE*scanline_width;
 		/* write out each of the four channels separately run length encoded */
 		/* first red, then green, then blue, then exponent */
 		for(i=0;i<4;i++) {
@@ -414,3 +424,243 @@ int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
 	return RGBE_RETURN_SUCCESS;
 }
 
+/* scale factor of every exponent byte, the same values as rgbe2float */
+static const float *rgbe_scale_table()
+{
+	static float table[256];
+	static int initialized = 0;
+	int e;
+
+	if (!initialized) {
+		table[0] = 0.0f;
+		for (e = 1; e < 256; e++)
+			table[e] = (float) ldexp(1.0,e-(int)(128+8));
+		initialized = 1;
+	}
+	return table;
+}
+
+void RGBE_FloatToRGBE(unsigned char *rgbe, const float *data, int numpixels)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 tiny = _mm_set1_ps(1e-32f);
+	const __m128i expMask = _mm_set1_epi32(0xff);
+	/* 4 pixels per iteration, reading 12 floats */
+	for (; i + 4 <= numpixels; i += 4) {
+		__m128 a = _mm_loadu_ps(data + 3*i);
+		__m128 b = _mm_loadu_ps(data + 3*i + 4);
+		__m128 c = _mm_loadu_ps(data + 3*i + 8);
+		/* deinterleave r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3 */
+		__m128 t = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1,1,2,2));
+		__m128 r = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2,0,3,0));
+		__m128 t0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0,0,1,1));
+		__m128 t1 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2,2,3,3));
+		__m128 g = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2,0,2,0));
+		t0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1,1,2,2));
+		t1 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3,3,0,0));
+		__m128 bl = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2,0,2,0));
+
+		r = _mm_max_ps(r, zero);
+		g = _mm_max_ps(g, zero);
+		bl = _mm_max_ps(bl, zero);
+		__m128 v = _mm_max_ps(r, _mm_max_ps(g, bl));
+
+		/* v = m * 2^e with m in [0.5, 1): e is the biased float exponent - 126,
+		 * the mantissas are the components times 2^(8-e) = 2^(134-biased) */
+		__m128i biased = _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(v), 23), expMask);
+		__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(
+			_mm_sub_epi32(_mm_set1_epi32(134+127), biased), 23));
+		__m128i e = _mm_add_epi32(biased, _mm_set1_epi32(128-126));
+
+		__m128i ri = _mm_cvttps_epi32(_mm_mul_ps(r, scale));
+		__m128i gi = _mm_cvttps_epi32(_mm_mul_ps(g, scale));
+		__m128i bi = _mm_cvttps_epi32(_mm_mul_ps(bl, scale));
+		__m128i pixel = _mm_or_si128(_mm_or_si128(ri, _mm_slli_epi32(gi, 8)),
+			_mm_or_si128(_mm_slli_epi32(bi, 16), _mm_slli_epi32(e, 24)));
+		/* black pixels are stored as 0 0 0 0 */
+		pixel = _mm_andnot_si128(_mm_castps_si128(_mm_cmplt_ps(v, tiny)), pixel);
+		_mm_storeu_si128((__m128i *)(rgbe + 4*i), pixel);
+	}
+#endif
+	for (; i < numpixels; i++)
+		float2rgbe(rgbe + 4*i, data[3*i+RGBE_DATA_RED],
+			data[3*i+RGBE_DATA_GREEN], data[3*i+RGBE_DATA_BLUE]);
+}
+
+void RGBE_RGBEToFloat(float *data, const unsigned char *rgbe, int numpixels)
+{
+	const float *table = rgbe_scale_table();
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	/* one pixel per vector; the 4th lane is overwritten by the next pixel,
+	 * so the last pixel is converted separately */
+	for (; i + 1 < numpixels; i++) {
+		__m128i p = _mm_cvtsi32_si128(*(const int *)(rgbe + 4*i));
+		p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(p), _mm_set1_ps(table[rgbe[4*i+3]]));
+		_mm_storeu_ps(data + 3*i, f);
+	}
+#endif
+	for (; i < numpixels; i++) {
+		float f = table[rgbe[4*i+3]];
+		data[3*i+RGBE_DATA_RED] = rgbe[4*i] * f;
+		data[3*i+RGBE_DATA_GREEN] = rgbe[4*i+1] * f;
+		data[3*i+RGBE_DATA_BLUE] = rgbe[4*i+2] * f;
+	}
+}
+
+/* converts a decoded RLE scanline (four planes of scanline_width bytes) */
+static void rgbe_planar2float(float *data, const unsigned char *planes,
+							  int scanline_width)
+{
+	const float *table = rgbe_scale_table();
+	const unsigned char *r = planes;
+	const unsigned char *g = planes + scanline_width;
+	const unsigned char *b = planes + 2*scanline_width;
+	const unsigned char *e = planes + 3*scanline_width;
+	int i;
+
+	for (i = 0; i < scanline_width; i++) {
+		float f = table[e[i]];
+		data[3*i+RGBE_DATA_RED] = r[i] * f;
+		data[3*i+RGBE_DATA_GREEN] = g[i] * f;
+		data[3*i+RGBE_DATA_BLUE] = b[i] * f;
+	}
+}
+
+/* decodes the four run length encoded channels of one scanline.
+ * returns the number of bytes consumed or -1 on errors. if planes is NULL
+ * the data is only skipped, which is used to index the scanlines. */
+static long rgbe_decode_scanline(unsigned char *planes, const unsigned char *in,
+								 long avail, int scanline_width)
+{
+	long pos = 4;
+	int i, count;
+
+	if (avail < 4 || in[0] != 2 || in[1] != 2 || (in[2] & 0x80)
+		|| (((int)in[2])<<8 | in[3]) != scanline_width)
+		return -1;
+	for (i = 0; i < 4; i++) {
+		int filled = 0;
+		while (filled < scanline_width) {
+			if (pos + 2 > avail)
+				return -1;
+			if (in[pos] > 128) {
+				/* a run of the same value */
+				count = in[pos]-128;
+				if (count > scanline_width - filled)
+					return -1;
+				if (planes)
+					memset(planes + i*scanline_width + filled, in[pos+1], count);
+				pos += 2;
+			}
+			else {
+				/* a non-run */
+				count = in[pos];
+				if ((count == 0)||(count > scanline_width - filled)||(pos + 1 + count > avail))
+					return -1;
+				if (planes)
+					memcpy(planes + i*scanline_width + filled, in + pos + 1, count);
+				pos += 1 + count;
+			}
+			filled += count;
+		}
+	}
+	return pos;
+}
+
+int RGBE_ReadPixels_RLE_Parallel(FILE *fp, float *data, int scanline_width,
+								 int num_scanlines, int flip)
+{
+	long start, end, size, *offsets;
+	unsigned char *file;
+	int y, failed = 0, bad = 0;
+	const long rowFloats = (long)scanline_width*RGBE_DATA_SIZE;
+
+	rgbe_scale_table();
+	start = ftell(fp);
+	if (fseek(fp, 0, SEEK_END) != 0)
+		return rgbe_error(rgbe_read_error,NULL);
+	end = ftell(fp);
+	fseek(fp, start, SEEK_SET);
+	size = end - start;
+
+	file = (unsigned char *)malloc(size > 0 ? size : 1);
+	if (file == NULL)
+		return rgbe_error(rgbe_memory_error,"unable to allocate buffer space");
+	if (fread(file, 1, size, fp) != (size_t)size) {
+		free(file);
+		return rgbe_error(rgbe_read_error,NULL);
+	}
+
+	/* flat files: every pixel has 4 bytes */
+	if ((scanline_width < 8)||(scanline_width > 0x7fff)||(size < 4)
+		||(file[0] != 2)||(file[1] != 2)||(file[2] & 0x80)) {
+		if (size < 4L*scanline_width*num_scanlines) {
+			free(file);
+			return rgbe_error(rgbe_read_error,NULL);
+		}
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+		for (y = 0; y < num_scanlines; y++)
+			RGBE_RGBEToFloat(data + (flip ? num_scanlines-1-y : y)*rowFloats,
+				file + 4L*scanline_width*y, scanline_width);
+		free(file);
+		return RGBE_RETURN_SUCCESS;
+	}
+
+	/* pass 1: index where every scanline starts */
+	offsets = (long *)malloc(sizeof(long)*(num_scanlines+1));
+	if (offsets == NULL) {
+		free(file);
+		return rgbe_error(rgbe_memory_error,"unable to allocate buffer space");
+	}
+	offsets[0] = 0;
+	for (y = 0; y < num_scanlines; y++) {
+		long used = rgbe_decode_scanline(NULL, file + offsets[y], size - offsets[y],
+			scanline_width);
+		if (used < 0) {
+			free(offsets);
+			free(file);
+			return rgbe_error(rgbe_format_error,"bad scanline data");
+		}
+		offsets[y+1] = offsets[y] + used;
+	}
+
+	/* pass 2: decode the scanlines independently into their final rows */
+#ifdef OPENMP
+#pragma omp parallel reduction(||:failed,bad)
+#endif
+	{
+		unsigned char *planes = (unsigned char *)malloc(4*scanline_width);
+		int row;
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (row = 0; row < num_scanlines; row++) {
+			if (planes == NULL) {
+				failed = 1;
+				continue;
+			}
+			if (rgbe_decode_scanline(planes, file + offsets[row],
+				size - offsets[row], scanline_width) < 0) {
+				bad = 1;
+				continue;
+			}
+			rgbe_planar2float(data + (flip ? num_scanlines-1-row : row)*rowFloats,
+				planes, scanline_width);
+		}
+		free(planes);
+	}
+	free(offsets);
+	free(file);
+	if (failed)
+		return rgbe_error(rgbe_memory_error,"unable to allocate buffer space");
+	if (bad)
+		return rgbe_error(rgbe_format_error,"bad scanline data");
+	return RGBE_RETURN_SUCCESS;
+}
@@ -48,6 +48,18 @@ int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width,
 int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
 			int num_scanlines);
 
+/* reads the rest of the file (run length encoded or flat) in two passes:
+ * the scanline offsets are indexed first, then the scanlines are decoded
+ * in parallel (with OPENMP). flip != 0 stores the first scanline of the
+ * file as the last row of data. */
+int RGBE_ReadPixels_RLE_Parallel(FILE *fp, float *data, int scanline_width,
+			int num_scanlines, int flip);
+
+/* batch conversion between float RGB triples and interleaved 4 byte rgbe
+ * pixels, SSE2 accelerated. the results equal the per pixel routines. */
+void RGBE_FloatToRGBE(unsigned char *rgbe, const float *data, int numpixels);
+void RGBE_RGBEToFloat(float *data, const unsigned char *rgbe, int numpixels);
+
 #endif /* _H_RGBE */
 
 
@@ -0,0 +1,274 @@
+/**
+ * Conversion between float colors and the compact texel encodings used by
+ * Texture: 8 bit linear and sRGB, half floats and shared exponent RGBE.
+ */
+
+#ifndef TEXEL_H
+#define TEXEL_H
+
+#include "vec.h"
+#include <cmath>
+#include <cstring>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+/**
+ * Converts a linear color component to its sRGB encoded value.
+ * @param v Linear value in [0, 1].
+ * @returns sRGB encoded value in [0, 1].
+ */
+inline float linear2srgb(float v)
+{
+	if (v <= 0.0031308f)
+		return 12.92f * v;
+	return 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+}
+
+/**
+ * Converts a sRGB encoded color component to linear.
+ * @param v sRGB encoded value in [0, 1].
+ * @returns Linear value in [0, 1].
+ */
+inline float srgb2linear(float v)
+{
+	if (v <= 0.04045f)
+		return v / 12.92f;
+	return powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+/**
+ * Lookup table from 8 bit sRGB values to linear floats.
+ * @returns Table with 256 entries, built on the first call.
+ */
+inline const float* srgb8_table()
+{
+	static float table[256];
+	static bool initialized = false;
+	if (!initialized)
+	{
+		for (int i = 0; i < 256; i++)
+			table[i] = srgb2linear(i / 255.0f);
+		initialized = true;
+	}
+	return table;
+}
+
+/**
+ * Encodes a linear color as 8 bit sRGB with an opaque alpha channel.
+ * @param out Out parameter: 4 bytes R, G, B, A.
+ * @param c Linear color, clamped to [0, 1].
+ */
+inline void float2srgb8(unsigned char out[4], const Vec3 &c)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		float v = c[i] < 0.0f ? 0.0f : (c[i] > 1.0f ? 1.0f : c[i]);
+		out[i] = (unsigned char) (linear2srgb(v) * 255.0f + 0.5f);
+	}
+	out[3] = 255;
+}
+
+/**
+ * Decodes an 8 bit sRGB texel.
+ * @param in 4 bytes R, G, B, A.
+ * @param table srgb8_table(), passed in to keep it out of the inner loop.
+ * @returns Linear color.
+ */
+inline Vec3 srgb82float(const unsigned char in[4], const float *table)
+{
+	return Vec3(table[in[0]], table[in[1]], table[in[2]]);
+}
+
+/**
+ * Lookup table from 8 bit values to linear floats in [0, 1].
+ * @remarks Entry i is i / 255.0f, the value load_image_ppm() produces for
+ * a byte i with ENCODING_LINEAR, so such images are stored without loss.
+ * @returns Table with 256 entries, built on the first call.
+ */
+inline const float* unorm8_table()
+{
+	static float table[256];
+	static bool initialized = false;
+	if (!initialized)
+	{
+		for (int i = 0; i < 256; i++)
+			table[i] = i / 255.0f;
+		initialized = true;
+	}
+	return table;
+}
+
+/**
+ * Encodes a linear color as 8 bit values with an opaque alpha channel.
+ * @param out Out parameter: 4 bytes R, G, B, A.
+ * @param c Linear color, clamped to [0, 1].
+ */
+inline void float2unorm8(unsigned char out[4], const Vec3 &c)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		float v = c[i] < 0.0f ? 0.0f : (c[i] > 1.0f ? 1.0f : c[i]);
+		out[i] = (unsigned char) (v * 255.0f + 0.5f);
+	}
+	out[3] = 255;
+}
+
+/**
+ * Converts a float to IEEE 754 half precision (round to nearest even).
+ * @param f Value to convert.
+ * @returns Bits of the half float.
+ */
+inline unsigned short float2half(float f)
+{
+#ifdef __F16C__
+	return _cvtss_sh(f, 0);
+#else
+	unsigned int x;
+	memcpy(&x, &f, sizeof(x));
+	unsigned int sign = (x >> 16) & 0x8000;
+	unsigned int absx = x & 0x7fffffff;
+
+	if (absx >= 0x7f800000) // Inf / NaN
+		return sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+	if (absx >= 0x477ff000) // too large, round to Inf
+		return sign | 0x7c00;
+	if (absx < 0x38800000) // denormal or zero
+	{
+		if (absx < 0x33000000)
+			return sign;
+		unsigned int mant = (absx & 0x007fffff) | 0x00800000;
+		int shift = 126 - (absx >> 23);
+		unsigned int h = mant >> shift;
+		unsigned int rest = mant & ((1u << shift) - 1);
+		unsigned int half = 1u << (shift - 1);
+		if (rest > half || (rest == half && (h & 1)))
+			h++;
+		return sign | h;
+	}
+	unsigned int h = ((absx - 0x38000000) >> 13);
+	unsigned int rest = absx & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++;
+	return sign | h;
+#endif
+}
+
+/**
+ * Converts IEEE 754 half precision bits to float.
+ * @param h Bits of the half float.
+ * @returns Value as float.
+ */
+inline float half2float(unsigned short h)
+{
+#ifdef __F16C__
+	return _cvtsh_ss(h);
+#else
+	unsigned int sign = (h & 0x8000) << 16;
+	unsigned int exp = (h >> 10) & 0x1f;
+	unsigned int mant = h & 0x3ff;
+	unsigned int x;
+
+	if (exp == 0x1f) // Inf / NaN
+		x = sign | 0x7f800000 | (mant << 13);
+	else if (exp != 0)
+		x = sign | ((exp + 112) << 23) | (mant << 13);
+	else if (mant == 0)
+		x = sign;
+	else
+	{
+		// denormal: normalize the mantissa
+		exp = 113;
+		while (!(mant & 0x400))
+		{
+			mant <<= 1;
+			exp--;
+		}
+		x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+	}
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+#endif
+}
+
+/**
+ * Encodes a color as three half floats.
+ * @param out Out parameter: 3 half floats R, G, B.
+ * @param c Color to encode.
+ */
+inline void float2rgb16f(unsigned short out[3], const Vec3 &c)
+{
+	out[0] = float2half(c.x);
+	out[1] = float2half(c.y);
+	out[2] = float2half(c.z);
+}
+
+/**
+ * Decodes three half floats.
+ * @param in 3 half floats R, G, B.
+ * @returns Decoded color.
+ */
+inline Vec3 rgb16f2float(const unsigned short in[3])
+{
+	return Vec3(half2float(in[0]), half2float(in[1]), half2float(in[2]));
+}
+
+/**
+ * Lookup table from RGBE exponent bytes to mantissa scale factors.
+ * @returns Table with 256 entries, built on the first call. Entry 0 is 0.
+ */
+inline const float* rgbe_exponent_table()
+{
+	static float table[256];
+	static bool initialized = false;
+	if (!initialized)
+	{
+		table[0] = 0.0f;
+		for (int e = 1; e < 256; e++)
+			table[e] = ldexpf(1.0f, e - (128 + 8));
+		initialized = true;
+	}
+	return table;
+}
+
+/**
+ * Encodes a color with a shared exponent.
+ * @remarks Uses the same convention as utils/rgbe.cpp, so colors read from
+ * a .hdr file are stored without loss.
+ * @param out Out parameter: 4 bytes R, G, B mantissas and exponent.
+ * @param c Color to encode. Negative components are clamped to 0.
+ */
+inline void float2rgbe8(unsigned char out[4], const Vec3 &c)
+{
+	float r = c.x > 0.0f ? c.x : 0.0f;
+	float g = c.y > 0.0f ? c.y : 0.0f;
+	float b = c.z > 0.0f ? c.z : 0.0f;
+	float v = r > g ? r : g;
+	v = v > b ? v : b;
+	if (v < 1e-32f)
+	{
+		out[0] = out[1] = out[2] = out[3] = 0;
+		return;
+	}
+	int e;
+	v = frexpf(v, &e) * 256.0f / v;
+	out[0] = (unsigned char) (r * v);
+	out[1] = (unsigned char) (g * v);
+	out[2] = (unsigned char) (b * v);
+	out[3] = (unsigned char) (e + 128);
+}
+
+/**
+ * Decodes a shared exponent color.
+ * @param in 4 bytes R, G, B mantissas and exponent.
+ * @param table rgbe_exponent_table(), passed in to keep it out of the inner loop.
+ * @returns Decoded color.
+ */
+inline Vec3 rgbe82float(const unsigned char in[4], const float *table)
+{
+	float f = table[in[3]];
+	return Vec3(in[0] * f, in[1] * f, in[2] * f);
+}
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * Fast Fourier Transformation of complex 2d arrays of any size.
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+
+/// Edge length of the blocks of the transpose between row and column passes.
+#define FFT_BLOCK 32
+
+struct Fft1d;
+
+/**
+ * Precomputed tables and scratch memory for 2d transforms of one size.
+ * @remarks The rows are transformed in parallel batches (OPENMP). Instead of
+ * striding through the whole array, the columns are brought into rows by
+ * a transpose in FFT_BLOCK x FFT_BLOCK blocks, transformed as rows and
+ * transposed back. A plan only holds read-only tables, so it can run
+ * several transforms concurrently; the scratch memory of the transpose
+ * is allocated by every call.
+ */
+struct FFTPlan
+{
+	/// Number of rows and columns of the arrays.
+	unsigned int resX, resY;
+	/// Tables of the transforms of length resY (rows) and resX (columns).
+	Fft1d* rows;
+	Fft1d* cols;
+	/// Next plan of the list of FFTPlan::get().
+	FFTPlan* next;
+
+	/**
+	 * Precomputes twiddles, bit reversal and chirp tables.
+	 * @param resX Number of rows.
+	 * @param resY Number of columns, consecutive in memory.
+	 */
+	FFTPlan(unsigned int resX, unsigned int resY);
+	~FFTPlan();
+
+	/**
+	 * Complex transform, see fft2d.
+	 */
+	void execute(std::complex<float>* out, const std::complex<float>* in,
+			int sign);
+
+	/**
+	 * Forward transform of a real array, see fft2d_r2c.
+	 */
+	void forwardReal(std::complex<float>* out, const float* in);
+
+	/**
+	 * Inverse transform to a real array, see fft2d_c2r.
+	 */
+	void inverseReal(float* out, std::complex<float>* in);
+
+	/**
+	 * Returns a plan for a size, created on the first request.
+	 * @remarks Plans are kept until the program ends, so a plan returned
+	 * to one thread is never freed while it runs and e.g.
+	 * a DFT followed by an IDFT of the same image share one plan.
+	 * @param resX Number of rows.
+	 * @param resY Number of columns.
+	 */
+	static FFTPlan* get(unsigned int resX, unsigned int resY);
+};
+
+/**
+ * 2d Fourier Transformation in O(N log N).
+ * @remarks Computes the same values as the direct evaluation of
+ * out[k1 * resY + k2] = 1 / sqrt(resX * resY) *
+ *     sum in[n1 * resY + n2] * exp(sign * 2 pi i (k1 n1 / resX + k2 n2 / resY))
+ * as a 1d transform of every row followed by one of every column.
+ * Power of two lengths use an iterative radix-4 FFT (with one radix-2 pass
+ * for odd exponents), all other lengths Bluestein's algorithm. Uses the
+ * FFTPlan::get() plan of the size. Like fft2d_r2c and fft2d_c2r it may be
+ * called from several threads at once, also for the same size.
+ * @param out The transformed array is stored here. May be equal to in.
+ * @param in Input array.
+ * @param resX Number of rows (index n1).
+ * @param resY Number of columns (index n2), consecutive in memory.
+ * @param sign -1 for the forward, +1 for the inverse transformation.
+ */
+void fft2d(std::complex<float>* out, const std::complex<float>* in,
+		unsigned int resX, unsigned int resY, int sign);
+
+/**
+ * Number of coefficients per row of a half spectrum: the columns
+ * k2 = 0 .. resY / 2 of the transform of a real array.
+ */
+inline unsigned int fft_half(unsigned int resY)
+{
+	return resY / 2 + 1;
+}
+
+/**
+ * Forward 2d Fourier Transformation of a real array.
+ * @remarks The transform of real data is Hermitian,
+ * F[k1][k2] = conj(F[(resX - k1) % resX][(resY - k2) % resY]), so only
+ * resX * fft_half(resY) coefficients are computed and stored. Two rows are
+ * transformed at once as real and imaginary part of one complex row.
+ * Same values and scaling as fft2d(.., -1) otherwise.
+ * @param out resX * fft_half(resY) coefficients, out[k1 * fft_half(resY) + k2].
+ * @param in resX * resY real values, in[n1 * resY + n2].
+ * @param resX Number of rows.
+ * @param resY Number of columns, consecutive in memory.
+ */
+void fft2d_r2c(std::complex<float>* out, const float* in, unsigned int resX,
+		unsigned int resY);
+
+/**
+ * Inverse 2d Fourier Transformation of a half spectrum to a real array.
+ * @remarks Inverse of fft2d_r2c. The missing coefficients are taken from
+ * the Hermitian symmetry, so in has to be (up to rounding) the half
+ * spectrum of a real array.
+ * @param out resX * resY real values.
+ * @param in resX * fft_half(resY) coefficients, overwritten.
+ * @param resX Number of rows.
+ * @param resY Number of columns, consecutive in memory.
+ */
+void fft2d_c2r(float* out, std::complex<float>* in, unsigned int resX,
+		unsigned int resY);
+
+#endif
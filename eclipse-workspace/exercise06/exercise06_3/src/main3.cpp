@@ -1,6 +1,7 @@
 #include <iostream>
 #include "fileio.h"
 #include "vec.h"
+#include "fft.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <complex>
@@ -21,7 +22,7 @@ inline float sq(float v)
 /**
  * Discrete Fourier Transformation.
  * @remarks Both in and out contain one element per pixel. Pixels are stored
- * in row major order.
+ * in row major order. Evaluated with the FFT of fft.h in O(N log N).
  * @param out The fourier transformed input image is stored here.
  * @param in Input image.
  * @param resX Input/output image width in pixels.
@@ -30,30 +31,7 @@ inline float sq(float v)
 void DFT(complex<float>* out, complex<float>* in, unsigned int resX,
 		unsigned int resY)
 {
-	for(int k1=0; k1 < resX; k1++){
-		for(int k2=0; k2 < resY; k2++){
-			complex<float> result=0.0f;
-			double PI = acos(-1);
-			for(int n1 = 0; n1<resX; n1++){
-				for(int n2 = 0; n2<resY; n2++){
-					complex<float> u (0, -2 * PI * ((float) k1/(float) resX) * (float) n1);
-					complex<float> v (0, -2 * PI * ((float) k2/(float) resY) * (float) n2);
-					result+= in[n1 * resY + n2] * exp(u) * exp(v);
-				}
-			}
-			
-			result=result/((float)sqrt((float) resX*(float) resY));
-			out[k1 * resY + k2]=result;
-		}
-	}
-
-	// TODO 6.3 a) Implement the DFT according to the function's documentation.
-	// To make OpenMP work, uncomment the following macros and place your most outer for-loop directly behind it.
-
-//#ifdef OPENMP
-//#pragma omp parallel for
-//#endif
-	// Most outer for-loop here!
+	fft2d(out, in, resX, resY, -1);
 }
 
 /**
@@ -68,29 +46,7 @@ void DFT(complex<float>* out, complex<float>* in, unsigned int resX,
 void IDFT(complex<float>* out, complex<float>* in, unsigned int resX,
 		unsigned int resY)
 {
-
-	// TODO 6.3 b) Implement the IDFT according to the function's documentation.
-	// To make OpenMP work, uncomment the following macros and place your most outer for-loop directly behind it.
-	for(int k1=0; k1 < resX; k1++){
-			for(int k2=0; k2 < resY; k2++){
-				complex<float> result=0.0f;
-				double PI = acos(-1);
-				for(int n1 = 0; n1<resX; n1++){
-					for(int n2 = 0; n2<resY; n2++){
-						complex<float> u (0, 2 * PI * ((float) k1/(float) resX) * (float) n1);
-						complex<float> v (0, 2 * PI * ((float) k2/(float) resY) * (float) n2);
-						result+= in[n1 * resY + n2] * exp(u) * exp(v);
-					}
-				}
-
-				result=result/((float)sqrt((float) resX*(float) resY));
-				out[k1 * resY + k2]=result;
-			}
-		}
-//#ifdef OPENMP
-//#pragma omp parallel for
-//#endif
-	// Most outer for-loop here!
+	fft2d(out, in, resX, resY, 1);
 }
 
 /**
@@ -274,19 +230,76 @@ void shiftHalf(float* out, float* in, unsigned int resX, unsigned int resY)
 	}
 }
 
+/**
+ * Converts an RGB image to grayscale in place, see rgb2Grayscale.
+ * @remarks Fuses rgb2Grayscale and grayscale2Rgb into one pass.
+ * @param gray The grayscale pixel brightnesses will be stored here.
+ * @param image Input RGB pixels, replaced by their grayscale version.
+ * @param resX Width of the input/output image.
+ * @param resY Height of the input/output image.
+ */
+void rgb2GrayscaleInPlace(float* gray, Vec3* image, unsigned int resX,
+		unsigned int resY)
+{
+	for (unsigned int p = 0; p < resX * resY; p++)
+	{
+		gray[p] = image[p].x * 0.3f + image[p].y * 0.59f + image[p].z * 0.11f;
+		image[p] = Vec3(gray[p]);
+	}
+}
+
+/**
+ * Renders the amplitudes of a half spectrum as RGB image.
+ * @remarks Computes the same image as Vec2Scalar, shiftHalf, normalize, log
+ * and grayscale2Rgb applied to the amplitudes of the full spectrum, in one
+ * pass over the output and without intermediate images. The amplitudes of
+ * the missing coefficients are taken from the Hermitian symmetry, see
+ * fft2d_r2c.
+ * @param out resX * resY pixels, the lowest frequency in the center.
+ * @param ampPhase resY * fft_half(resX) amplitude/phase pairs of the
+ * transform of a real image.
+ * @param resX Width of the image (columns of the transform).
+ * @param resY Height of the image (rows of the transform).
+ */
+void spectrum2Rgb(Vec3* out, const Vec2* ampPhase, unsigned int resX,
+		unsigned int resY)
+{
+	unsigned int half = fft_half(resX);
+	float max = 0.0f;
+	for (unsigned int p = 0; p < resY * half; p++)
+		max = ampPhase[p].x > max ? ampPhase[p].x : max;
+	float scale = max > 0.0f ? 1.0f / max : 1.0f;
+
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int yo = 0; yo < (int) resY; yo++)
+	{
+		unsigned int k1 = (yo + resY - resY / 2) % resY;
+		const Vec2* row = ampPhase + k1 * half;
+		const Vec2* mirrored = ampPhase + ((resY - k1) % resY) * half;
+		for (unsigned int xo = 0; xo < resX; xo++)
+		{
+			unsigned int k2 = (xo + resX - resX / 2) % resX;
+			float a = k2 < half ? row[k2].x : mirrored[resX - k2].x;
+			float v = log(a * scale) * 0.1f + 1.0f;
+			out[yo * resX + xo] = Vec3(v < 0.0f ? 0.0f : v);
+		}
+	}
+}
+
 /**
  * Main function. Loads the image whose filename is given as parameter
  * and processes it:
  * <ul>
  *  <li>Conversion to grayscale *</li>
- *  <li>Conversion to complex numbers</li>
  *  <li>Conversion to fourier space</li>
  *  <li>Conversion to polar coordinate (amplitude/phase) representation *</li>
  *  <li>Back-conversion to cartesian fourier space</li>
- *  <li>Back-conversion to image space</li>
- *  <li>Back-conversion to grayscale (non-complex)*</li>
+ *  <li>Back-conversion to image space (non-complex)*</li>
  * </ul>
- * An image is saved for each step marked with a *.
+ * An image is saved for each step marked with a *. The image is real, so
+ * only the half spectrum of fft2d_r2c is computed and processed.
  * @param argc Number of program parameters.
  * @param argv Array of program parameters.
  */
@@ -300,80 +313,46 @@ int main(int argc, char **argv)
 	int resX, resY;
 	load_image_ppm(argv[1], floatRgbImage, resX, resY);
 
-	float* tmpImage1 = new float[resX * resY];
-	float* tmpImage1_ = new float[resX * resY];
-	complex<float>* tmpImage2 = new complex<float> [resX * resY];
-	Vec3* tmpImage3 = new Vec3[resX * resY];
-
+	// The image has resY rows of resX pixels. The input is reused for every
+	// output image, the gray values for the reconstruction.
+	Vec3* rgbImage = (Vec3*) floatRgbImage;
+	unsigned int half = fft_half(resX);
 	float* grayImage = new float[resX * resY];
-	complex<float>* gray2complexImage = new complex<float> [resX * resY];
-	complex<float>* gray2complex2fourierImage = new complex<float> [resX * resY];
-	Vec2* gray2complex2fourier2ampPhaseImage = new Vec2[resX * resY];
-
-	complex<float>* gray2complex2fourier2ampPhase2fourierImage = new complex<
-			float> [resX * resY];
-	complex<float>* gray2complex2fourier2ampPhase2fourier2complexImage =
-			new complex<float> [resX * resY];
-	float* gray2complex2fourier2ampPhase2fourier2complex2grayImage =
-			new float[resX * resY];
+	complex<float>* fourierImage = new complex<float> [resY * half];
+	Vec2* ampPhaseImage = new Vec2[resY * half];
 
 	// Convert to grayscale
-	rgb2Grayscale(grayImage, (Vec3*) floatRgbImage, resX, resY);
+	rgb2GrayscaleInPlace(grayImage, rgbImage, resX, resY);
 	// Output
-	grayscale2Rgb(tmpImage3, grayImage, resX, resY);
-	save_image_ppm("grayImage.ppm", (float*) tmpImage3, resX, resY);
+	save_image_ppm("grayImage.ppm", floatRgbImage, resX, resY);
 	cout << "Finished converting to grayscale" << endl;
 
 	// Convert to fourier space
-	Real2Complex(gray2complexImage, grayImage, resX, resY);
-	DFT(gray2complex2fourierImage, gray2complexImage, resX, resY);
+	fft2d_r2c(fourierImage, grayImage, resY, resX);
 
 	// Convert to amplitude/phase description
-	Complex2AmplitudePhase(gray2complex2fourier2ampPhaseImage,
-			gray2complex2fourierImage, resX, resY);
+	Complex2AmplitudePhase(ampPhaseImage, fourierImage, resY, half);
 	// Output
-	Vec2Scalar(tmpImage1, gray2complex2fourier2ampPhaseImage, resX, resY);
-	shiftHalf(tmpImage1_, tmpImage1, resX, resY);
-	normalize(tmpImage1_, resX, resY);
-	log(tmpImage1_, resX, resY);
-	grayscale2Rgb(tmpImage3, tmpImage1_, resX, resY);
-	save_image_ppm("gray2complex2fourier2ampPhaseImage.ppm", (float*) tmpImage3,
+	spectrum2Rgb(rgbImage, ampPhaseImage, resX, resY);
+	save_image_ppm("gray2complex2fourier2ampPhaseImage.ppm", floatRgbImage,
 			resX, resY);
 	cout << "Finished converting to amplitude" << endl;
 
 	// Convert back to real/imaginary vector fourier base description
-	AmplitudePhase2Complex(gray2complex2fourier2ampPhase2fourierImage,
-			gray2complex2fourier2ampPhaseImage, resX, resY);
+	AmplitudePhase2Complex(fourierImage, ampPhaseImage, resY, half);
 
 	// Convert back to grayscale
-	IDFT(gray2complex2fourier2ampPhase2fourier2complexImage,
-			gray2complex2fourier2ampPhase2fourierImage, resX, resY);
-	Complex2Real(gray2complex2fourier2ampPhase2fourier2complex2grayImage,
-			gray2complex2fourier2ampPhase2fourier2complexImage, resX, resY);
+	fft2d_c2r(grayImage, fourierImage, resY, resX);
 	// Output
-	grayscale2Rgb(tmpImage3,
-			gray2complex2fourier2ampPhase2fourier2complex2grayImage, resX,
-			resY);
+	grayscale2Rgb(rgbImage, grayImage, resX, resY);
 	save_image_ppm(
 			"gray2complex2fourier2ampPhase2fourier2complex2grayImage.ppm",
-			(float*) tmpImage3, resX, resY);
+			floatRgbImage, resX, resY);
 
 	delete[] floatRgbImage;
-
-	delete[] tmpImage1;
-	delete[] tmpImage1_;
-	delete[] tmpImage2;
-	delete[] tmpImage3;
-
 	delete[] grayImage;
-	delete[] gray2complexImage;
-	delete[] gray2complex2fourierImage;
-	delete[] gray2complex2fourier2ampPhaseImage;
-
-	delete[] gray2complex2fourier2ampPhase2fourierImage;
-	delete[] gray2complex2fourier2ampPhase2fourier2complexImage;
-	delete[] gray2complex2fourier2ampPhase2fourier2complex2grayImage;
+	delete[] fourierImage;
+	delete[] ampPhaseImage;
 
 	return 0;
 }
-
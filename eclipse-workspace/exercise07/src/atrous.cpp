@@ -0,0 +1,94 @@
+/**
+ * A-trous wavelet transformation, see atrous.h.
+ */
+
+#include "atrous.h"
+
+BilateralWeights* atrous_weights(float sigmaR)
+{
+	static const float b3[2 * ATROUS_RADIUS + 1] =
+	{ 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+	const int size = 2 * ATROUS_RADIUS + 1;
+	float spatial[size * size];
+	for (int j = 0; j < size; j++)
+		for (int i = 0; i < size; i++)
+			spatial[j * size + i] = b3[j] * b3[i];
+	return new BilateralWeights(ATROUS_RADIUS, spatial, sigmaR);
+}
+
+void atrous_smooth(float* out, const float* in, const int resX,
+		const int resY, int level, const BilateralWeights& weights)
+{
+	bilateral_planes(out, in, resX, resY, weights, 1 << level);
+}
+
+void atrous_transform(Vec3** out, const Vec3* in, const int resX,
+		const int resY, const int n, float sigmaR)
+{
+	const int N = resX * resY;
+	BilateralWeights* weights = atrous_weights(sigmaR);
+	float* c = new float[3 * N];
+	float* next = new float[3 * N];
+	for (int p = 0; p < N; p++)
+		for (int ch = 0; ch < 3; ch++)
+			c[ch * N + p] = in[p][ch];
+
+	for (int level = 0; level < n - 1; level++)
+	{
+		atrous_smooth(next, c, resX, resY, level, *weights);
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+		for (int p = 0; p < N; p++)
+			out[level][p] = Vec3(c[p] - next[p], c[N + p] - next[N + p],
+					c[2 * N + p] - next[2 * N + p]);
+		float* tmp = c;
+		c = next;
+		next = tmp;
+	}
+	for (int p = 0; p < N; p++)
+		out[n - 1][p] = Vec3(c[p], c[N + p], c[2 * N + p]);
+
+	delete[] next;
+	delete[] c;
+	delete weights;
+}
+
+void atrous_filter(Vec3* out, const Vec3* in, const int resX, const int resY,
+		const int n, const float* alpha, float sigmaR)
+{
+	const int N = resX * resY;
+	BilateralWeights* weights = atrous_weights(sigmaR);
+	float* c = new float[3 * N];
+	float* next = new float[3 * N];
+	for (int p = 0; p < N; p++)
+		for (int ch = 0; ch < 3; ch++)
+			c[ch * N + p] = in[p][ch];
+
+	for (int level = 0; level < n - 1; level++)
+	{
+		atrous_smooth(next, c, resX, resY, level, *weights);
+		const float a = alpha[level];
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+		for (int p = 0; p < N; p++)
+		{
+			Vec3 d = a * Vec3(c[p] - next[p], c[N + p] - next[N + p],
+					c[2 * N + p] - next[2 * N + p]);
+			out[p] = level > 0 ? out[p] + d : d;
+		}
+		float* tmp = c;
+		c = next;
+		next = tmp;
+	}
+	for (int p = 0; p < N; p++)
+	{
+		Vec3 coarse(c[p], c[N + p], c[2 * N + p]);
+		out[p] = n > 1 ? out[p] + coarse : coarse;
+	}
+
+	delete[] next;
+	delete[] c;
+	delete weights;
+}
@@ -0,0 +1,75 @@
+/**
+ * A-trous wavelet transformation with the B3 spline and an optional
+ * edge-stopping function.
+ */
+
+#ifndef ATROUS_H
+#define ATROUS_H
+
+#include "vec.h"
+#include "bilateral.h"
+
+/// Radius of the B3 spline kernel in taps.
+#define ATROUS_RADIUS 2
+
+/**
+ * Tabulates the 5x5 B3 spline taps ([1 4 6 4 1] / 16 in both directions)
+ * and the range weights of the edge-stopping function.
+ * @param sigmaR Sigma of the gauss kernel of the edge-stopping function
+ * over the RGB distance. Infinite for the plain a-trous transformation.
+ * @returns Weights for atrous_smooth(), to be deleted by the caller.
+ */
+BilateralWeights* atrous_weights(float sigmaR);
+
+/**
+ * Smooths one level of the a-trous transformation: c_(level + 1) from
+ * c_level, with the B3 taps 2^level pixels apart.
+ * @remarks See bilateral_planes(): the sums of a row are vectorized across
+ * pixels, rows are filtered in parallel (OPENMP). Pixels outside the image
+ * are left out.
+ * @param out Output parameter. c_(level + 1) as 3 planes of resX resY
+ * floats. Must not be in.
+ * @param in c_level as 3 planes of resX resY floats.
+ * @param resX Width of the images in pixels.
+ * @param resY Height of the images in pixels.
+ * @param level Level of in, starting at 0 for the image.
+ * @param weights Weights from atrous_weights().
+ */
+void atrous_smooth(float* out, const float* in, const int resX,
+		const int resY, int level, const BilateralWeights& weights);
+
+/**
+ * Decomposes an image into n levels: the details d_l = c_l - c_(l + 1) for
+ * l = 0 .. n - 2 and the coarsest smoothing c_(n - 1).
+ * @remarks The smoothings are ping-ponged between two scratch images of
+ * planes, so besides the output only two images are allocated.
+ * @param out Output parameter. out[l] is d_l for l < n - 1, out[n - 1] is
+ * c_(n - 1). n images of resX resY pixels.
+ * @param in Image to process (c_0).
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param n Number of levels to create, at least 1.
+ * @param sigmaR Sigma of the edge-stopping function, infinite for none.
+ */
+void atrous_transform(Vec3** out, const Vec3* in, const int resX,
+		const int resY, const int n, float sigmaR);
+
+/**
+ * Decomposes an image like atrous_transform() and reconstructs it with
+ * weighted details in one pass: out = sum of alpha[l] d_l over
+ * l = 0 .. n - 2 plus c_(n - 1).
+ * @remarks Every detail is added to out as soon as it is produced, so only
+ * the two scratch images and out are alive instead of the n levels, and
+ * the details are neither written nor read back.
+ * @param out Output parameter. Contains the reconstructed image. May be in.
+ * @param in Image to process (c_0).
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param n Number of levels, at least 1.
+ * @param alpha n - 1 weights of the details d_0 .. d_(n - 2).
+ * @param sigmaR Sigma of the edge-stopping function, infinite for none.
+ */
+void atrous_filter(Vec3* out, const Vec3* in, const int resX, const int resY,
+		const int n, const float* alpha, float sigmaR);
+
+#endif
@@ -0,0 +1,531 @@
+/**
+ * Bilateral filters, see bilateral.h.
+ */
+
+#include "bilateral.h"
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+/**
+ * Blurs the lines of a grid of 4 floats per cell along one axis with a
+ * normalized kernel of 2 radius + 1 weights. Cells outside are 0.
+ * @param grid Grid, blurred in place.
+ * @param count Number of cells along the axis.
+ * @param stride Distance of neighboring cells along the axis in cells.
+ * @param lines Number of lines. Line l starts at cell
+ * (l / innerLines) * outerStride + (l % innerLines) * innerStride.
+ */
+static void grid_blur(float* grid, int count, long stride, int lines,
+		int innerLines, long innerStride, long outerStride,
+		const float* weights, int radius)
+{
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		float* line = new float[4 * count];
+#ifdef OPENMP
+#pragma omp for
+#endif
+		for (int l = 0; l < lines; l++)
+		{
+			float* first = grid + 4 * ((l / innerLines) * outerStride
+					+ (l % innerLines) * innerStride);
+			for (int i = 0; i < count; i++)
+				memcpy(line + 4 * i, first + 4 * i * stride, 4 * sizeof(float));
+			for (int i = 0; i < count; i++)
+			{
+				float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				int kMin = i - radius < 0 ? radius - i : 0;
+				int kMax = i + radius >= count ? radius + count - 1 - i : 2 * radius;
+				for (int k = kMin; k <= kMax; k++)
+				{
+					const float* c = line + 4 * (i + k - radius);
+					for (int j = 0; j < 4; j++)
+						v[j] += weights[k] * c[j];
+				}
+				memcpy(first + 4 * i * stride, v, 4 * sizeof(float));
+			}
+		}
+		delete[] line;
+	}
+}
+
+void bilateral_grid(Vec3* out, const Vec3* in, const int resX, const int resY,
+		float sigmaS, float sigmaR, float accuracy)
+{
+	const int N = resX * resY;
+	float* luminance = new float[N];
+	float lMin = INFINITY, lMax = -INFINITY;
+	for (int p = 0; p < N; p++)
+	{
+		luminance[p] = in[p].x * 0.3f + in[p].y * 0.59f + in[p].z * 0.11f;
+		lMin = luminance[p] < lMin ? luminance[p] : lMin;
+		lMax = luminance[p] > lMax ? luminance[p] : lMax;
+	}
+
+	// Blur of accuracy cells, so sigma in pixels; the grid is padded by the
+	// radius of the blur and one cell for the trilinear interpolation.
+	const float cellS = sigmaS / accuracy;
+	const float cellR = sigmaR / accuracy;
+	const int radius = (int) ceilf(3.0f * accuracy);
+	const int pad = radius + 1;
+	const int gx = (int) ((resX - 1) / cellS) + 2 + 2 * pad;
+	const int gy = (int) ((resY - 1) / cellS) + 2 + 2 * pad;
+	const int gz = (int) ((lMax - lMin) / cellR) + 2 + 2 * pad;
+	const long cells = (long) gx * gy * gz;
+	// Cell (x, y, z) with z innermost.
+	float* grid = new float[4 * cells];
+	memset(grid, 0, 4 * cells * sizeof(float));
+
+	// Splat: every pixel adds (color, 1) to the 8 surrounding cells.
+	for (int y = 0; y < resY; y++)
+		for (int x = 0; x < resX; x++)
+		{
+			int p = y * resX + x;
+			float fx = x / cellS + pad;
+			float fy = y / cellS + pad;
+			float fz = (luminance[p] - lMin) / cellR + pad;
+			int ix = (int) fx, iy = (int) fy, iz = (int) fz;
+			float wx = fx - ix, wy = fy - iy, wz = fz - iz;
+			for (int c = 0; c < 8; c++)
+			{
+				float w = (c & 1 ? wx : 1.0f - wx) * (c & 2 ? wy : 1.0f - wy)
+						* (c & 4 ? wz : 1.0f - wz);
+				float* cell = grid + 4 * (((long) (ix + (c & 1)) * gy
+						+ iy + ((c >> 1) & 1)) * gz + iz + ((c >> 2) & 1));
+				cell[0] += w * in[p].x;
+				cell[1] += w * in[p].y;
+				cell[2] += w * in[p].z;
+				cell[3] += w;
+			}
+		}
+
+	float* weights = new float[2 * radius + 1];
+	float sum = 0.0f;
+	for (int k = 0; k <= 2 * radius; k++)
+	{
+		weights[k] = expf(-0.5f * (k - radius) * (k - radius)
+				/ (accuracy * accuracy));
+		sum += weights[k];
+	}
+	for (int k = 0; k <= 2 * radius; k++)
+		weights[k] /= sum;
+
+	// Blur along z, y and x.
+	grid_blur(grid, gz, 1, gx * gy, 1, 0, gz, weights, radius);
+	grid_blur(grid, gy, gz, gx * gz, gz, 1, (long) gy * gz, weights, radius);
+	grid_blur(grid, gx, (long) gy * gz, gy * gz, 1, 0, 1, weights, radius);
+	delete[] weights;
+
+	// Slice: trilinear interpolation of the blurred grid at every pixel.
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int y = 0; y < resY; y++)
+		for (int x = 0; x < resX; x++)
+		{
+			int p = y * resX + x;
+			float fx = x / cellS + pad;
+			float fy = y / cellS + pad;
+			float fz = (luminance[p] - lMin) / cellR + pad;
+			int ix = (int) fx, iy = (int) fy, iz = (int) fz;
+			float wx = fx - ix, wy = fy - iy, wz = fz - iz;
+			float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int c = 0; c < 8; c++)
+			{
+				float w = (c & 1 ? wx : 1.0f - wx) * (c & 2 ? wy : 1.0f - wy)
+						* (c & 4 ? wz : 1.0f - wz);
+				const float* cell = grid + 4 * (((long) (ix + (c & 1)) * gy
+						+ iy + ((c >> 1) & 1)) * gz + iz + ((c >> 2) & 1));
+				for (int j = 0; j < 4; j++)
+					v[j] += w * cell[j];
+			}
+			out[p] = v[3] > 0.0f ? Vec3(v[0], v[1], v[2]) / v[3] : in[p];
+		}
+
+	delete[] grid;
+	delete[] luminance;
+}
+
+/**
+ * Hash table of the occupied vertices of a permutohedral lattice. A vertex
+ * is identified by its first LATTICE_D coordinates; the last one follows
+ * from the coordinates summing up to 0.
+ */
+struct LatticeHash
+{
+	/// LATTICE_D coordinates per vertex.
+	int* keys;
+	/// Number of vertices and capacity of keys.
+	int count, capacity;
+	/// Open addressing table of vertex indices, -1 for empty slots.
+	int* table;
+	/// Size of table, a power of two.
+	unsigned int tableSize;
+
+	LatticeHash(int capacity) :
+			count(0), capacity(capacity)
+	{
+		keys = new int[LATTICE_D * capacity];
+		tableSize = 1;
+		while (tableSize < 2u * capacity)
+			tableSize *= 2;
+		table = new int[tableSize];
+		memset(table, -1, tableSize * sizeof(int));
+	}
+
+	~LatticeHash()
+	{
+		delete[] keys;
+		delete[] table;
+	}
+
+	static unsigned int hash(const int* key)
+	{
+		unsigned int h = 0;
+		for (int i = 0; i < LATTICE_D; i++)
+			h = (h + key[i]) * 2531011u;
+		return h;
+	}
+
+	/**
+	 * Returns the index of a vertex, -1 if it does not exist and create is
+	 * false. Only creating lookups modify the table.
+	 */
+	int find(const int* key, bool create)
+	{
+		unsigned int h = hash(key) & (tableSize - 1);
+		while (true)
+		{
+			int e = table[h];
+			if (e < 0)
+			{
+				if (!create || count == capacity)
+					return -1;
+				memcpy(keys + LATTICE_D * count, key, LATTICE_D * sizeof(int));
+				table[h] = count;
+				return count++;
+			}
+			if (!memcmp(keys + LATTICE_D * e, key, LATTICE_D * sizeof(int)))
+				return e;
+			h = (h + 1) & (tableSize - 1);
+		}
+	}
+};
+
+void bilateral_permutohedral(Vec3* out, const Vec3* in, const int resX,
+		const int resY, float sigmaS, float sigmaR)
+{
+	const int d = LATTICE_D;
+	const int N = resX * resY;
+
+	// Features are scaled so one blur of the lattice corresponds to a gauss
+	// kernel of sigma 1 (Adams et al.).
+	float scale[d];
+	float invStdDev = (d + 1) * sqrtf(2.0f / 3.0f);
+	for (int i = 0; i < d; i++)
+		scale[i] = invStdDev / sqrtf((float) (i + 1) * (i + 2));
+	int canonical[(d + 1) * (d + 1)];
+	for (int i = 0; i <= d; i++)
+	{
+		for (int j = 0; j <= d - i; j++)
+			canonical[i * (d + 1) + j] = i;
+		for (int j = d - i + 1; j <= d; j++)
+			canonical[i * (d + 1) + j] = i - (d + 1);
+	}
+
+	// Splat: the vertices and barycentric weights of every pixel are kept
+	// for the slice.
+	LatticeHash lattice(N * (d + 1));
+	int* offsets = new int[N * (d + 1)];
+	float* barycentrics = new float[N * (d + 1)];
+	float* values = new float[4 * N * (d + 1)];
+	memset(values, 0, 4 * N * (d + 1) * sizeof(float));
+
+	for (int p = 0; p < N; p++)
+	{
+		float f[d] = { (p % resX) / sigmaS, (p / resX) / sigmaS,
+				in[p].x / sigmaR, in[p].y / sigmaR, in[p].z / sigmaR };
+
+		// Elevates the feature onto the hyperplane sum x = 0 in d + 1 dims.
+		float elevated[d + 1];
+		elevated[d] = -d * f[d - 1] * scale[d - 1];
+		for (int i = d - 1; i > 0; i--)
+			elevated[i] = elevated[i + 1] - i * f[i - 1] * scale[i - 1]
+					+ (i + 2) * f[i] * scale[i];
+		elevated[0] = elevated[1] + 2 * f[0] * scale[0];
+
+		// Closest vertex of the lattice of points with coordinates that are
+		// multiples of d + 1 and the ranks of the differences to it.
+		int greedy[d + 1];
+		int sum = 0;
+		for (int i = 0; i <= d; i++)
+		{
+			float v = elevated[i] / (d + 1);
+			float up = ceilf(v) * (d + 1);
+			float down = floorf(v) * (d + 1);
+			greedy[i] = (int) (up - elevated[i] < elevated[i] - down ? up : down);
+			sum += greedy[i];
+		}
+		sum /= d + 1;
+		int rank[d + 1];
+		memset(rank, 0, sizeof(rank));
+		for (int i = 0; i < d; i++)
+			for (int j = i + 1; j <= d; j++)
+				if (elevated[i] - greedy[i] < elevated[j] - greedy[j])
+					rank[i]++;
+				else
+					rank[j]++;
+		if (sum > 0)
+		{
+			for (int i = 0; i <= d; i++)
+				if (rank[i] >= d + 1 - sum)
+				{
+					greedy[i] -= d + 1;
+					rank[i] += sum - (d + 1);
+				}
+				else
+					rank[i] += sum;
+		}
+		else if (sum < 0)
+		{
+			for (int i = 0; i <= d; i++)
+				if (rank[i] < -sum)
+				{
+					greedy[i] += d + 1;
+					rank[i] += (d + 1) + sum;
+				}
+				else
+					rank[i] += sum;
+		}
+
+		float barycentric[d + 2];
+		memset(barycentric, 0, sizeof(barycentric));
+		for (int i = 0; i <= d; i++)
+		{
+			float delta = (elevated[i] - greedy[i]) / (d + 1);
+			barycentric[d - rank[i]] += delta;
+			barycentric[d + 1 - rank[i]] -= delta;
+		}
+		barycentric[0] += 1.0f + barycentric[d + 1];
+
+		for (int r = 0; r <= d; r++)
+		{
+			int key[d];
+			for (int i = 0; i < d; i++)
+				key[i] = greedy[i] + canonical[r * (d + 1) + rank[i]];
+			int v = lattice.find(key, true);
+			offsets[p * (d + 1) + r] = v;
+			barycentrics[p * (d + 1) + r] = barycentric[r];
+			float* value = values + 4 * v;
+			value[0] += barycentric[r] * in[p].x;
+			value[1] += barycentric[r] * in[p].y;
+			value[2] += barycentric[r] * in[p].z;
+			value[3] += barycentric[r];
+		}
+	}
+
+	// Blur: [1 2 1] / 4 along every lattice direction. Vertices that are not
+	// in the lattice count as 0.
+	const int M = lattice.count;
+	float* blurred = new float[4 * M];
+	for (int j = 0; j <= d; j++)
+	{
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+		for (int v = 0; v < M; v++)
+		{
+			const int* key = lattice.keys + d * v;
+			int n1[d], n2[d];
+			for (int i = 0; i < d; i++)
+			{
+				n1[i] = key[i] + 1;
+				n2[i] = key[i] - 1;
+			}
+			if (j < d)
+			{
+				n1[j] = key[j] - d;
+				n2[j] = key[j] + d;
+			}
+			int i1 = lattice.find(n1, false);
+			int i2 = lattice.find(n2, false);
+			const float* a = i1 >= 0 ? values + 4 * i1 : 0;
+			const float* b = i2 >= 0 ? values + 4 * i2 : 0;
+			for (int i = 0; i < 4; i++)
+				blurred[4 * v + i] = 0.5f * values[4 * v + i]
+						+ (a ? 0.25f * a[i] : 0.0f) + (b ? 0.25f * b[i] : 0.0f);
+		}
+		float* tmp = values;
+		values = blurred;
+		blurred = tmp;
+	}
+	delete[] blurred;
+
+	// Slice: interpolation with the weights of the splat.
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < N; p++)
+	{
+		float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int r = 0; r <= d; r++)
+		{
+			const float* value = values + 4 * offsets[p * (d + 1) + r];
+			float w = barycentrics[p * (d + 1) + r];
+			for (int i = 0; i < 4; i++)
+				v[i] += w * value[i];
+		}
+		out[p] = v[3] > 0.0f ? Vec3(v[0], v[1], v[2]) / v[3] : in[p];
+	}
+
+	delete[] values;
+	delete[] offsets;
+	delete[] barycentrics;
+}
+
+/// Fills the table of range weights of a BilateralWeights.
+static void range_table(BilateralWeights& weights, float sigmaR)
+{
+	// The entries only depend on the squared distance in units of sigma^2;
+	// an infinite sigma maps every distance to the first entry.
+	weights.range = new float[RANGE_TABLE_SIZE + 1];
+	for (int k = 0; k < RANGE_TABLE_SIZE; k++)
+		weights.range[k] = expf(-0.5f * RANGE_TABLE_EXTENT * k / RANGE_TABLE_SIZE);
+	weights.range[RANGE_TABLE_SIZE] = 0.0f;
+	weights.rangeScale = RANGE_TABLE_SIZE
+			/ (RANGE_TABLE_EXTENT * sigmaR * sigmaR);
+}
+
+BilateralWeights::BilateralWeights(float sigmaS, float sigmaR)
+{
+	radius = (int) ceilf(3.0f * sigmaS);
+	const int size = 2 * radius + 1;
+	spatial = new float[size * size];
+	for (int j = 0; j < size; j++)
+		for (int i = 0; i < size; i++)
+			spatial[j * size + i] = expf(-0.5f
+					* ((i - radius) * (i - radius) + (j - radius) * (j - radius))
+					/ (sigmaS * sigmaS));
+	range_table(*this, sigmaR);
+}
+
+BilateralWeights::BilateralWeights(int radius, const float* spatial,
+		float sigmaR)
+{
+	this->radius = radius;
+	const int size = 2 * radius + 1;
+	this->spatial = new float[size * size];
+	memcpy(this->spatial, spatial, size * size * sizeof(float));
+	range_table(*this, sigmaR);
+}
+
+BilateralWeights::~BilateralWeights()
+{
+	delete[] spatial;
+	delete[] range;
+}
+
+void bilateral_planes(float* out, const float* in, const int resX,
+		const int resY, const BilateralWeights& weights, int step)
+{
+	const int N = resX * resY;
+	const int radius = weights.radius;
+	const int size = 2 * radius + 1;
+	const bool edgeStopping = weights.rangeScale > 0.0f;
+	const float* r = in;
+	const float* g = in + N;
+	const float* b = in + 2 * N;
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		// Sums of the weighted channels and of the weights of one row.
+		float* sums = new float[4 * resX];
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for (int y = 0; y < resY; y++)
+		{
+			memset(sums, 0, 4 * resX * sizeof(float));
+			float* sumR = sums;
+			float* sumG = sums + resX;
+			float* sumB = sums + 2 * resX;
+			float* sumW = sums + 3 * resX;
+			const float* cr = r + y * resX;
+			const float* cg = g + y * resX;
+			const float* cb = b + y * resX;
+			for (int j = -radius; j <= radius; j++)
+			{
+				int ny = y + j * step;
+				if (ny < 0 || ny >= resY)
+					continue;
+				for (int i = -radius; i <= radius; i++)
+				{
+					const float ws = weights.spatial[(j + radius) * size + i
+							+ radius];
+					if (ws == 0.0f)
+						continue;
+					const int dx = i * step;
+					const int x0 = dx < 0 ? -dx : 0;
+					const int x1 = dx > 0 ? resX - dx : resX;
+					const float* nr = r + ny * resX + dx;
+					const float* ng = g + ny * resX + dx;
+					const float* nb = b + ny * resX + dx;
+					if (edgeStopping)
+					{
+						for (int x = x0; x < x1; x++)
+						{
+							float dr = nr[x] - cr[x];
+							float dg = ng[x] - cg[x];
+							float db = nb[x] - cb[x];
+							float w = ws
+									* weights.Range(dr * dr + dg * dg + db * db);
+							sumR[x] += w * nr[x];
+							sumG[x] += w * ng[x];
+							sumB[x] += w * nb[x];
+							sumW[x] += w;
+						}
+					}
+					else
+					{
+						for (int x = x0; x < x1; x++)
+						{
+							sumR[x] += ws * nr[x];
+							sumG[x] += ws * ng[x];
+							sumB[x] += ws * nb[x];
+							sumW[x] += ws;
+						}
+					}
+				}
+			}
+			for (int x = 0; x < resX; x++)
+			{
+				float norm = 1.0f / sumW[x];
+				out[y * resX + x] = sumR[x] * norm;
+				out[N + y * resX + x] = sumG[x] * norm;
+				out[2 * N + y * resX + x] = sumB[x] * norm;
+			}
+		}
+		delete[] sums;
+	}
+}
+
+void bilateral_direct(Vec3* out, const Vec3* in, const int resX,
+		const int resY, const BilateralWeights& weights, int step)
+{
+	const int N = resX * resY;
+	float* planes = new float[6 * N];
+	for (int p = 0; p < N; p++)
+		for (int c = 0; c < 3; c++)
+			planes[c * N + p] = in[p][c];
+	bilateral_planes(planes + 3 * N, planes, resX, resY, weights, step);
+	for (int p = 0; p < N; p++)
+		for (int c = 0; c < 3; c++)
+			out[p][c] = planes[(3 + c) * N + p];
+	delete[] planes;
+}
@@ -0,0 +1,147 @@
+/**
+ * Approximate bilateral filters whose cost is O(N) for any sigma: the
+ * bilateral grid (Paris and Durand) with a grayscale range and the
+ * permutohedral lattice (Adams, Baek and Davis) with an RGB range.
+ *
+ * Both lift the pixels into a coarse grid over position and color, blur the
+ * grid and read the result back, so the cost depends on the number of
+ * pixels and occupied grid cells instead of the size of the window.
+ *
+ * The exact filter is evaluated from tables of the spatial and range weights
+ * (BilateralWeights), also with holes between the taps for the edge-stopping
+ * a-trous transformation.
+ */
+
+#ifndef BILATERAL_H
+#define BILATERAL_H
+
+#include "vec.h"
+
+/// Dimension of the position + RGB space of the permutohedral lattice.
+#define LATTICE_D 5
+/// Number of entries of the table of range weights.
+#define RANGE_TABLE_SIZE 4096
+/// Squared color distance, in units of sigma^2, covered by the table of range
+/// weights. Larger distances get the weight 0 (instead of at most 2e-8).
+#define RANGE_TABLE_EXTENT 36.0f
+
+/**
+ * Weights of a bilateral filter: a table of the spatial weights of the
+ * window and a table of the range weights over the squared color distance,
+ * so neither sqrt nor exp are evaluated per tap.
+ */
+struct BilateralWeights
+{
+	/// Radius of the window in taps.
+	int radius;
+	/// (2 radius + 1)^2 spatial weights, row by row.
+	float* spatial;
+	/// RANGE_TABLE_SIZE + 1 range weights; entry k belongs to the squared
+	/// distance k / rangeScale, the last one is 0.
+	float* range;
+	/// Table entries per unit of squared color distance.
+	float rangeScale;
+
+	/**
+	 * Tabulates the weights of a gauss kernel in space and range.
+	 * @param sigmaS Sigma of the spatial gauss kernel in taps. The window
+	 * has a radius of ceil(3 sigmaS) taps.
+	 * @param sigmaR Sigma of the range gauss kernel. May be infinite, then
+	 * all range weights are 1.
+	 */
+	BilateralWeights(float sigmaS, float sigmaR);
+
+	/**
+	 * Tabulates given spatial weights and the range weights of a gauss
+	 * kernel.
+	 * @param radius Radius of the window in taps.
+	 * @param spatial (2 radius + 1)^2 spatial weights row by row, copied.
+	 * @param sigmaR Sigma of the range gauss kernel. May be infinite.
+	 */
+	BilateralWeights(int radius, const float* spatial, float sigmaR);
+	~BilateralWeights();
+
+	/**
+	 * Returns the range weight of a squared color distance, rounded to the
+	 * nearest entry of the table (relative error below 0.25%).
+	 */
+	inline float Range(float distance2) const
+	{
+		float f = distance2 * rangeScale + 0.5f;
+		return range[(int) (f < RANGE_TABLE_SIZE ? f : RANGE_TABLE_SIZE)];
+	}
+};
+
+/**
+ * Filters an image with the exact bilateral filter: every pixel becomes the
+ * average of the pixels of the window weighted by spatial weight times the
+ * range weight of their RGB distance to it.
+ * @remarks The channels are split into planes and the sums of a row are
+ * accumulated tap by tap over all pixels of the row, so the inner loop is
+ * vectorized across neighboring output pixels. Rows are filtered in
+ * parallel (OPENMP). Pixels outside the image are left out.
+ * @param out Output parameter. Contains the filtered image. Must not be in.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param weights Weights of the filter.
+ * @param step Distance of neighboring taps in pixels; larger than 1 for the
+ * a-trous transformation.
+ */
+void bilateral_direct(Vec3* out, const Vec3* in, const int resX,
+		const int resY, const BilateralWeights& weights, int step = 1);
+
+/**
+ * bilateral_direct() on images stored as three planes of floats (all red
+ * values, then all green ones, then all blue ones), for callers that filter
+ * the same image repeatedly. Taps with a spatial weight of 0 are skipped,
+ * and with an infinite sigmaR the range weights are not looked up.
+ * @param out Output parameter. 3 resX resY floats. Must not be in.
+ * @param in 3 resX resY floats.
+ */
+void bilateral_planes(float* out, const float* in, const int resX,
+		const int resY, const BilateralWeights& weights, int step = 1);
+
+/**
+ * Filters an image with a bilateral filter whose range weights are taken
+ * from the difference of the luminances (0.3 R + 0.59 G + 0.11 B).
+ * @remarks The colors are splatted trilinearly into a grid of cells of
+ * sigmaS / accuracy pixels and sigmaR / accuracy luminance, the grid is
+ * blurred with a gauss kernel of accuracy cells (truncated at 3 sigma) and
+ * sliced trilinearly. The blur and slice run in parallel (OPENMP).
+ * @param out Output parameter. Contains the filtered image. May be in.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param sigmaS Sigma of the gauss kernel for weighting by spatial distance.
+ * @param sigmaR Sigma of the gauss kernel for weighting by luminance
+ * difference.
+ * @param accuracy Grid cells per sigma. 1 is usually enough, larger values
+ * approach the exact filter at a cost of O(accuracy^4) per cell.
+ */
+void bilateral_grid(Vec3* out, const Vec3* in, const int resX, const int resY,
+		float sigmaS, float sigmaR, float accuracy = 1.0f);
+
+/**
+ * Filters an image with a bilateral filter whose range weights are taken
+ * from the RGB distance, like the direct evaluation.
+ * @remarks Every pixel is splatted to the d + 1 = 6 vertices of the simplex
+ * of the permutohedral lattice over (x, y, R, G, B) that contains it. The
+ * occupied vertices are kept in a hash table, blurred with [1 2 1] along
+ * each of the d + 1 lattice directions and interpolated back. The blur and
+ * slice run in parallel (OPENMP).
+ * @param out Output parameter. Contains the filtered image. May be in.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param sigmaS Sigma of the gauss kernel for weighting by spatial distance.
+ * @param sigmaR Sigma of the gauss kernel for weighting by color difference.
+ * @remarks The lattice spacing is fixed: the splat, one blur and the slice
+ * together approximate the gauss kernel. A finer lattice leaves more
+ * neighbors unoccupied, which truncates the blur, so unlike bilateral_grid
+ * there is no accuracy parameter.
+ */
+void bilateral_permutohedral(Vec3* out, const Vec3* in, const int resX,
+		const int resY, float sigmaS, float sigmaR);
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * Box filter and guided filter, see boxfilter.h.
+ */
+
+#include "boxfilter.h"
+#include <cstring>
+
+/// Number of channels of the means of guided_filter()'s first pass.
+#define GUIDED_STATISTICS 21
+/// Number of channels of the coefficients of guided_filter().
+#define GUIDED_COEFFICIENTS 12
+
+/// Adds a row of values to sums, scaled by sign.
+static inline void add_row(double* sums, const float* row, int count,
+		double sign)
+{
+	for (int i = 0; i < count; i++)
+		sums[i] += sign * row[i];
+}
+
+void box_mean(float* out, const float* in, const int resX, const int resY,
+		int channels, int radius)
+{
+	const int rowLength = resX * channels;
+	const int numBands = (resY + BOX_BAND - 1) / BOX_BAND;
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		// Sums of the columns of the window, per channel.
+		double* cols = new double[rowLength];
+		double* sum = new double[channels];
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for (int band = 0; band < numBands; band++)
+		{
+			const int y0 = band * BOX_BAND;
+			const int y1 = y0 + BOX_BAND < resY ? y0 + BOX_BAND : resY;
+
+			memset(cols, 0, rowLength * sizeof(double));
+			int top = y0 - radius > 0 ? y0 - radius : 0;
+			int bottom = y0 + radius < resY - 1 ? y0 + radius : resY - 1;
+			for (int y = top; y <= bottom; y++)
+				add_row(cols, in + y * rowLength, rowLength, 1.0);
+
+			for (int y = y0; y < y1; y++)
+			{
+				if (y > y0)
+				{
+					// Moves the column sums down by one row.
+					if (y - radius - 1 >= 0)
+						add_row(cols, in + (y - radius - 1) * rowLength, rowLength,
+								-1.0);
+					if (y + radius < resY)
+						add_row(cols, in + (y + radius) * rowLength, rowLength, 1.0);
+				}
+				const int rows = (y + radius < resY - 1 ? y + radius : resY - 1)
+						- (y - radius > 0 ? y - radius : 0) + 1;
+
+				// Running sum of the column sums along the row.
+				for (int c = 0; c < channels; c++)
+					sum[c] = 0.0;
+				for (int x = 0; x < radius && x < resX; x++)
+					for (int c = 0; c < channels; c++)
+						sum[c] += cols[x * channels + c];
+				float* row = out + y * rowLength;
+				for (int x = 0; x < resX; x++)
+				{
+					if (x + radius < resX)
+						for (int c = 0; c < channels; c++)
+							sum[c] += cols[(x + radius) * channels + c];
+					if (x - radius - 1 >= 0)
+						for (int c = 0; c < channels; c++)
+							sum[c] -= cols[(x - radius - 1) * channels + c];
+					const int columns = (x + radius < resX - 1 ? x + radius : resX - 1)
+							- (x - radius > 0 ? x - radius : 0) + 1;
+					const double norm = 1.0 / ((double) rows * columns);
+					for (int c = 0; c < channels; c++)
+						row[x * channels + c] = (float) (sum[c] * norm);
+				}
+			}
+		}
+		delete[] sum;
+		delete[] cols;
+	}
+}
+
+void box_filter(Vec3* out, const Vec3* in, const int resX, const int resY,
+		int radius)
+{
+	box_mean((float*) out, (const float*) in, resX, resY, 3, radius);
+}
+
+void guided_filter(Vec3* out, const Vec3* in, const Vec3* guide,
+		const int resX, const int resY, int radius, float eps)
+{
+	const int N = resX * resY;
+
+	// Means of I, p, I_c p_k and I_c I_d (c <= d) over the windows.
+	float* statistics = new float[GUIDED_STATISTICS * N];
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < N; p++)
+	{
+		float* s = statistics + GUIDED_STATISTICS * p;
+		const Vec3& I = guide[p];
+		const Vec3& v = in[p];
+		for (int c = 0; c < 3; c++)
+		{
+			s[c] = I[c];
+			s[3 + c] = v[c];
+			for (int k = 0; k < 3; k++)
+				s[6 + 3 * c + k] = I[c] * v[k];
+		}
+		s[15] = I.x * I.x;
+		s[16] = I.x * I.y;
+		s[17] = I.x * I.z;
+		s[18] = I.y * I.y;
+		s[19] = I.y * I.z;
+		s[20] = I.z * I.z;
+	}
+	float* means = new float[GUIDED_STATISTICS * N];
+	box_mean(means, statistics, resX, resY, GUIDED_STATISTICS, radius);
+	delete[] statistics;
+
+	// Coefficients a_k (3 x 3) and b_k of the affine functions per window:
+	// a_k = (Sigma + eps U)^-1 cov(I, p_k), b_k = mean(p_k) - a_k mean(I).
+	float* coefficients = new float[GUIDED_COEFFICIENTS * N];
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < N; p++)
+	{
+		const float* m = means + GUIDED_STATISTICS * p;
+		float* a = coefficients + GUIDED_COEFFICIENTS * p;
+		const float* mI = m;
+		const float* mp = m + 3;
+
+		float sxx = m[15] - mI[0] * mI[0] + eps;
+		float sxy = m[16] - mI[0] * mI[1];
+		float sxz = m[17] - mI[0] * mI[2];
+		float syy = m[18] - mI[1] * mI[1] + eps;
+		float syz = m[19] - mI[1] * mI[2];
+		float szz = m[20] - mI[2] * mI[2] + eps;
+
+		// Inverse of the symmetric covariance by cofactors.
+		float ixx = syy * szz - syz * syz;
+		float ixy = sxz * syz - sxy * szz;
+		float ixz = sxy * syz - sxz * syy;
+		float iyy = sxx * szz - sxz * sxz;
+		float iyz = sxz * sxy - sxx * syz;
+		float izz = sxx * syy - sxy * sxy;
+		float invDet = 1.0f / (sxx * ixx + sxy * ixy + sxz * ixz);
+
+		for (int k = 0; k < 3; k++)
+		{
+			float cx = m[6 + k] - mI[0] * mp[k];
+			float cy = m[9 + k] - mI[1] * mp[k];
+			float cz = m[12 + k] - mI[2] * mp[k];
+			float ax = (ixx * cx + ixy * cy + ixz * cz) * invDet;
+			float ay = (ixy * cx + iyy * cy + iyz * cz) * invDet;
+			float az = (ixz * cx + iyz * cy + izz * cz) * invDet;
+			a[3 * k] = ax;
+			a[3 * k + 1] = ay;
+			a[3 * k + 2] = az;
+			a[9 + k] = mp[k] - ax * mI[0] - ay * mI[1] - az * mI[2];
+		}
+	}
+	delete[] means;
+	float* meanCoefficients = new float[GUIDED_COEFFICIENTS * N];
+	box_mean(meanCoefficients, coefficients, resX, resY, GUIDED_COEFFICIENTS,
+			radius);
+	delete[] coefficients;
+
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < N; p++)
+	{
+		const float* a = meanCoefficients + GUIDED_COEFFICIENTS * p;
+		const Vec3 I = guide[p];
+		for (int k = 0; k < 3; k++)
+			out[p][k] = a[3 * k] * I.x + a[3 * k + 1] * I.y + a[3 * k + 2] * I.z
+					+ a[9 + k];
+	}
+	delete[] meanCoefficients;
+}
@@ -0,0 +1,66 @@
+/**
+ * Box filter with running sums, whose cost per pixel does not depend on the
+ * radius, and the guided filter (He, Sun and Tang) built on it.
+ */
+
+#ifndef BOXFILTER_H
+#define BOXFILTER_H
+
+#include "vec.h"
+
+/// Number of rows the image is split into for parallel processing.
+#define BOX_BAND 64
+
+/**
+ * Averages every channel of an image over (2 radius + 1)^2 windows. Pixels
+ * outside the image are left out, so the windows at the border are smaller.
+ * @remarks Every band of BOX_BAND rows keeps running sums of the columns of
+ * the window, which are moved down by one row per output row, and a running
+ * sum along the row over them. The sums are kept in double, so adding and
+ * subtracting values along the image does not accumulate rounding errors.
+ * Bands are filtered in parallel (OPENMP).
+ * @param out Output parameter. resX resY pixels of channels floats. Must not
+ * be in.
+ * @param in resX resY pixels of channels interleaved floats.
+ * @param resX Width of the images in pixels.
+ * @param resY Height of the images in pixels.
+ * @param channels Number of floats per pixel.
+ * @param radius Radius of the window.
+ */
+void box_mean(float* out, const float* in, const int resX, const int resY,
+		int channels, int radius);
+
+/**
+ * Averages an RGB image over (2 radius + 1)^2 windows, see box_mean().
+ * @param out Output parameter. Contains the filtered image. Must not be in.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param radius Radius of the window.
+ */
+void box_filter(Vec3* out, const Vec3* in, const int resX, const int resY,
+		int radius);
+
+/**
+ * Filters an image with the guided filter using a color guide: in every
+ * window the output is an affine function of the guide, fitted to the input
+ * by least squares with the regularization eps, and the functions of all
+ * windows covering a pixel are averaged.
+ * @remarks An edge-preserving smoothing at the cost of two box_mean()
+ * passes over 21 and 12 channels, independent of the radius. With the
+ * image as its own guide it resembles a bilateral filter with a spatial
+ * sigma of about radius / 2 and a range sigma of about sqrt(eps).
+ * @param out Output parameter. Contains the filtered image. May be in or
+ * guide.
+ * @param in Image to process.
+ * @param guide Image whose edges are preserved, may be in.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param radius Radius of the windows.
+ * @param eps Regularization: variances of the guide well below eps are
+ * smoothed away, edges with larger variances kept.
+ */
+void guided_filter(Vec3* out, const Vec3* in, const Vec3* guide,
+		const int resX, const int resY, int radius, float eps);
+
+#endif
@@ -0,0 +1,387 @@
+/**
+ * Convolution of RGB images, see convolution.h.
+ */
+
+#include "convolution.h"
+#include "fft.h"
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+/// Time of one weight of the direct sum per pixel in ns (all channels).
+#define SPATIAL_COST 2.0f
+/// Time of the forward and inverse real FFTs of the 3 channels of a tile
+/// per value and log2(size) in ns. Both measured on 512x512 images.
+#define FFT_COST 5.0f
+
+ConvolutionKernel::ConvolutionKernel(int width, int height,
+		const float* weights) :
+		width(width), height(height), centerX(width / 2),
+		centerY(height / 2), tile(0), spectrum(0)
+{
+	this->weights = new float[width * height];
+	memcpy(this->weights, weights, width * height * sizeof(float));
+	sum = 0.0f;
+	for (int i = 0; i < width * height; i++)
+		sum += weights[i];
+}
+
+ConvolutionKernel::~ConvolutionKernel()
+{
+	delete[] weights;
+	delete[] spectrum;
+}
+
+const complex<float>* ConvolutionKernel::Spectrum(unsigned int tile)
+{
+	if (this->tile == tile)
+		return spectrum;
+
+	// The mirrored kernel with its center at the origin, wrapped around the
+	// tile, turns the circular convolution into out(p) = sum w(d) in(p + d).
+	float* k = new float[tile * tile];
+	memset(k, 0, tile * tile * sizeof(float));
+	for (int j = 0; j < height; j++)
+		for (int i = 0; i < width; i++)
+		{
+			int x = ((centerX - i) % (int) tile + tile) % tile;
+			int y = ((centerY - j) % (int) tile + tile) % tile;
+			k[y * tile + x] += weights[j * width + i];
+		}
+
+	delete[] spectrum;
+	spectrum = new complex<float> [tile * fft_half(tile)];
+	fft2d_r2c(spectrum, k, tile, tile);
+	// fft2d is unitary; the product of two spectra needs a factor sqrt(N).
+	for (unsigned int i = 0; i < tile * fft_half(tile); i++)
+		spectrum[i] *= (float) tile;
+	delete[] k;
+
+	this->tile = tile;
+	return spectrum;
+}
+
+unsigned int convolution_tile(const ConvolutionKernel& kernel, int resX,
+		int resY)
+{
+	int size = kernel.width > kernel.height ? kernel.width : kernel.height;
+	unsigned int maxTile = CONVOLUTION_MAX_TILE;
+	while ((int) maxTile < 2 * size)
+		maxTile *= 2;
+
+	double best = (double) SPATIAL_COST * kernel.width * kernel.height * resX
+			* resY;
+	unsigned int bestTile = 0;
+	unsigned int tile = 1;
+	while ((int) tile < size)
+		tile *= 2;
+	for (; tile <= maxTile; tile *= 2)
+	{
+		int validX = tile - kernel.width + 1;
+		int validY = tile - kernel.height + 1;
+		long tiles = (long) ((resX + validX - 1) / validX)
+				* ((resY + validY - 1) / validY);
+		double cost = (double) FFT_COST * tiles * tile * tile
+				* log2((double) tile * tile);
+		if (cost < best)
+		{
+			best = cost;
+			bestTile = tile;
+		}
+		// Larger tiles would only pad a single tile further.
+		if (validX >= resX && validY >= resY)
+			break;
+	}
+	return bestTile;
+}
+
+
+/// Direct evaluation of convolve().
+static void convolve_spatial(Vec3* out, const Vec3* in, const int resX,
+		const int resY, const ConvolutionKernel& kernel, int border)
+{
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int y = 0; y < resY; y++)
+		for (int x = 0; x < resX; x++)
+		{
+			Vec3 value(0.0f);
+			float weightSum = 0.0f;
+			for (int j = 0; j < kernel.height; j++)
+			{
+				int sy = y + j - kernel.centerY;
+				if (border != BORDER_NORMALIZE)
+					sy = border_coord(sy, resY, border);
+				else if (sy < 0 || sy >= resY)
+					continue;
+				const float* w = kernel.weights + j * kernel.width;
+				for (int i = 0; i < kernel.width; i++)
+				{
+					int sx = x + i - kernel.centerX;
+					if (border != BORDER_NORMALIZE)
+						sx = border_coord(sx, resX, border);
+					else if (sx < 0 || sx >= resX)
+						continue;
+					value += in[sy * resX + sx] * w[i];
+					weightSum += w[i];
+				}
+			}
+			if (border == BORDER_NORMALIZE && weightSum != kernel.sum)
+				value = weightSum != 0.0f ?
+						value * (kernel.sum / weightSum) : Vec3(0.0f);
+			out[y * resX + x] = value;
+		}
+}
+
+/**
+ * Overlap-save evaluation of convolve(): every tile x tile block of the
+ * input is multiplied with the kernel spectrum, the pixels of the result
+ * that did not wrap around are kept.
+ */
+static void convolve_fft(Vec3* out, const Vec3* in, const int resX,
+		const int resY, ConvolutionKernel& kernel, int border, unsigned int tile)
+{
+	const complex<float>* K = kernel.Spectrum(tile);
+	unsigned int size = tile * tile;
+	unsigned int spectrumSize = tile * fft_half(tile);
+	int validX = tile - kernel.width + 1;
+	int validY = tile - kernel.height + 1;
+
+	// Planes R, G, B and the mask of pixels inside the image.
+	float* planes = new float[4 * size];
+	complex<float>* spectrum = new complex<float> [spectrumSize];
+
+	for (int ty = 0; ty < resY; ty += validY)
+		for (int tx = 0; tx < resX; tx += validX)
+		{
+			int x0 = tx - kernel.centerX;
+			int y0 = ty - kernel.centerY;
+			bool inside = x0 >= 0 && y0 >= 0 && x0 + (int) tile <= resX
+					&& y0 + (int) tile <= resY;
+			bool masked = border == BORDER_NORMALIZE && !inside;
+			int numPlanes = masked ? 4 : 3;
+
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+			for (int j = 0; j < (int) tile; j++)
+			{
+				int sy = y0 + j;
+				bool rowInside = sy >= 0 && sy < resY;
+				sy = border_coord(sy, resY, border);
+				for (unsigned int i = 0; i < tile; i++)
+				{
+					int sx = x0 + i;
+					bool pixelInside = rowInside && sx >= 0 && sx < resX;
+					Vec3 v(0.0f);
+					if (pixelInside || border != BORDER_NORMALIZE)
+						v = in[sy * resX + border_coord(sx, resX, border)];
+					unsigned int p = j * tile + i;
+					planes[p] = v.x;
+					planes[size + p] = v.y;
+					planes[2 * size + p] = v.z;
+					planes[3 * size + p] = pixelInside ? 1.0f : 0.0f;
+				}
+			}
+
+			for (int c = 0; c < numPlanes; c++)
+			{
+				float* plane = planes + c * size;
+				fft2d_r2c(spectrum, plane, tile, tile);
+				for (unsigned int i = 0; i < spectrumSize; i++)
+					spectrum[i] *= K[i];
+				fft2d_c2r(plane, spectrum, tile, tile);
+			}
+
+			int endY = ty + validY < resY ? validY : resY - ty;
+			int endX = tx + validX < resX ? validX : resX - tx;
+			for (int j = 0; j < endY; j++)
+				for (int i = 0; i < endX; i++)
+				{
+					unsigned int p = (kernel.centerY + j) * tile + kernel.centerX
+							+ i;
+					Vec3 v(planes[p], planes[size + p], planes[2 * size + p]);
+					if (masked)
+					{
+						float weightSum = planes[3 * size + p];
+						v = fabsf(weightSum) > 1e-6f * fabsf(kernel.sum) ?
+								v * (kernel.sum / weightSum) : Vec3(0.0f);
+					}
+					out[(ty + j) * resX + tx + i] = v;
+				}
+		}
+
+	delete[] spectrum;
+	delete[] planes;
+}
+
+void convolve(Vec3* out, const Vec3* in, const int resX, const int resY,
+		ConvolutionKernel& kernel, int border, int method)
+{
+	unsigned int tile = 0;
+	if (method == CONVOLUTION_FFT)
+	{
+		int size = kernel.width > kernel.height ? kernel.width : kernel.height;
+		tile = 1;
+		while ((int) tile < 2 * size)
+			tile *= 2;
+	}
+	else if (method == CONVOLUTION_AUTO)
+		tile = convolution_tile(kernel, resX, resY);
+
+	if (tile)
+		convolve_fft(out, in, resX, resY, kernel, border, tile);
+	else
+		convolve_spatial(out, in, resX, resY, kernel, border);
+}
+
+/**
+ * Weights that remain of a kernel around each pixel of a row or column with
+ * BORDER_NORMALIZE, relative to the sum of the kernel.
+ * @param scale Output parameter: res factors that rescale the remaining
+ * weights to the sum of the kernel.
+ */
+static void border_scale(float* scale, int res, const float* weights, int size)
+{
+	float sum = 0.0f;
+	for (int i = 0; i < size; i++)
+		sum += weights[i];
+	int center = size / 2;
+	for (int p = 0; p < res; p++)
+	{
+		float remaining = 0.0f;
+		for (int i = 0; i < size; i++)
+			if (p + i - center >= 0 && p + i - center < res)
+				remaining += weights[i];
+		scale[p] = remaining != 0.0f ? sum / remaining : 0.0f;
+	}
+}
+
+/**
+ * Copies a row of floats with 3 channels per pixel to row[pad * 3 ..] and
+ * fills pad pixels on both sides according to the border mode.
+ */
+static void pad_row(float* row, const float* in, int res, int pad, int border)
+{
+	for (int p = -pad; p < res + pad; p++)
+	{
+		float* dst = row + (p + pad) * 3;
+		if (p >= 0 && p < res)
+		{
+			dst[0] = in[p * 3];
+			dst[1] = in[p * 3 + 1];
+			dst[2] = in[p * 3 + 2];
+		}
+		else if (border == BORDER_NORMALIZE)
+			dst[0] = dst[1] = dst[2] = 0.0f;
+		else
+		{
+			const float* src = in + border_coord(p, res, border) * 3;
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+		}
+	}
+}
+
+void convolve_separable(Vec3* out, const Vec3* in, const int resX,
+		const int resY, const float* weightsX, int sizeX, const float* weightsY,
+		int sizeY, int border)
+{
+	// The kernels reach at most size / 2 pixels to either side.
+	int padX = sizeX / 2;
+	int padY = sizeY / 2;
+	int width = 3 * resX;
+
+	float* scaleX = 0;
+	float* scaleY = 0;
+	if (border == BORDER_NORMALIZE)
+	{
+		scaleX = new float[resX];
+		scaleY = new float[resY];
+		border_scale(scaleX, resX, weightsX, sizeX);
+		border_scale(scaleY, resY, weightsY, sizeY);
+	}
+
+	// Row pass into tmp, which has padY more rows above and below the image
+	// that are filled according to the border mode afterwards.
+	float* tmp = new float[(resY + 2 * padY) * width];
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		float* row = new float[width + 6 * padX];
+#ifdef OPENMP
+#pragma omp for
+#endif
+		for (int y = 0; y < resY; y++)
+		{
+			pad_row(row, (const float*) (in + y * resX), resX, padX, border);
+			float* dst = tmp + (y + padY) * width;
+			for (int j = 0; j < width; j++)
+				dst[j] = 0.0f;
+			for (int i = 0; i < sizeX; i++)
+			{
+				const float w = weightsX[i];
+				const float* s = row + 3 * i;
+				for (int j = 0; j < width; j++)
+					dst[j] += w * s[j];
+			}
+			if (scaleX)
+				for (int x = 0; x < resX; x++)
+				{
+					dst[3 * x] *= scaleX[x];
+					dst[3 * x + 1] *= scaleX[x];
+					dst[3 * x + 2] *= scaleX[x];
+				}
+		}
+		delete[] row;
+	}
+	for (int p = -padY; p < resY + padY; p++)
+		if (p < 0 || p >= resY)
+		{
+			float* dst = tmp + (p + padY) * width;
+			if (border == BORDER_NORMALIZE)
+				memset(dst, 0, width * sizeof(float));
+			else
+				memcpy(dst, tmp + (border_coord(p, resY, border) + padY) * width,
+						width * sizeof(float));
+		}
+
+	// Column pass on strips of CONVOLUTION_STRIP pixels.
+	const int strip = 3 * CONVOLUTION_STRIP;
+	const int numStrips = (width + strip - 1) / strip;
+	float* dstBase = (float*) out;
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int s = 0; s < numStrips; s++)
+	{
+		int x0 = s * strip;
+		int n = x0 + strip < width ? strip : width - x0;
+		for (int y = 0; y < resY; y++)
+		{
+			float* dst = dstBase + y * width + x0;
+			const float* src = tmp + y * width + x0;
+			float acc[strip];
+			for (int j = 0; j < n; j++)
+				acc[j] = 0.0f;
+			for (int i = 0; i < sizeY; i++)
+			{
+				const float w = weightsY[i];
+				const float* r = src + i * width;
+				for (int j = 0; j < n; j++)
+					acc[j] += w * r[j];
+			}
+			const float scale = scaleY ? scaleY[y] : 1.0f;
+			for (int j = 0; j < n; j++)
+				dst[j] = acc[j] * scale;
+		}
+	}
+
+	delete[] tmp;
+	delete[] scaleX;
+	delete[] scaleY;
+}
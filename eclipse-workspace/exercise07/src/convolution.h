@@ -0,0 +1,147 @@
+/**
+ * Convolution of RGB images with arbitrary kernels. Small kernels are
+ * evaluated directly, large ones with FFTs on overlap-save tiles, so the
+ * cost per pixel stays O(log N) for any kernel size. Separable kernels are
+ * applied as a row and a column pass.
+ */
+
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include "vec.h"
+#include <complex>
+
+/// Largest edge length of the tiles of the frequency domain path.
+#define CONVOLUTION_MAX_TILE 512
+/// Width in pixels of the strips the column pass of convolve_separable()
+/// works on, so the rows under the kernel stay in the L1 cache.
+#define CONVOLUTION_STRIP 64
+
+/**
+ * Treatment of pixels outside the image.
+ */
+enum ConvolutionBorder
+{
+	/// The nearest pixel inside the image is repeated.
+	BORDER_CLAMP,
+	/// Pixels outside the image are left out and the remaining weights are
+	/// rescaled to the sum of the kernel (for kernels with a positive sum).
+	BORDER_NORMALIZE,
+	/// The image is reflected at its border pixels, which are not repeated.
+	BORDER_MIRROR
+};
+
+/// Clamps a pixel coordinate to [0, res - 1].
+inline int clamp_coord(int v, int res)
+{
+	return v < 0 ? 0 : (v >= res ? res - 1 : v);
+}
+
+/// Maps a pixel coordinate into [0, res - 1] by BORDER_CLAMP or BORDER_MIRROR.
+inline int border_coord(int v, int res, int border)
+{
+	if (border != BORDER_MIRROR || res == 1)
+		return clamp_coord(v, res);
+	int period = 2 * (res - 1);
+	v %= period;
+	if (v < 0)
+		v += period;
+	return v < res ? v : period - v;
+}
+
+/**
+ * Evaluation strategy of convolve().
+ */
+enum ConvolutionMethod
+{
+	/// Whichever of the two is estimated to be faster.
+	CONVOLUTION_AUTO,
+	/// Direct sum over the kernel.
+	CONVOLUTION_SPATIAL,
+	/// Products of spectra of overlap-save tiles.
+	CONVOLUTION_FFT
+};
+
+/**
+ * Filter kernel. Caches its spectrum for the tile size it was last used with.
+ */
+struct ConvolutionKernel
+{
+	/// Size of the kernel in pixels.
+	int width, height;
+	/// Pixel of the kernel that is centered on the filtered pixel.
+	int centerX, centerY;
+	/// width * height weights, row by row.
+	float* weights;
+	/// Sum of all weights.
+	float sum;
+	/// Edge length of the tiles spectrum belongs to, 0 if not computed yet.
+	unsigned int tile;
+	/// Spectrum of the mirrored kernel, tile * fft_half(tile) values.
+	std::complex<float>* spectrum;
+
+	/**
+	 * Creates a kernel centered at (width / 2, height / 2).
+	 * @param width Width of the kernel.
+	 * @param height Height of the kernel.
+	 * @param weights width * height weights row by row, copied.
+	 */
+	ConvolutionKernel(int width, int height, const float* weights);
+	~ConvolutionKernel();
+
+	/**
+	 * Returns the spectrum for tiles of an edge length, computed on the
+	 * first request for that length.
+	 * @param tile Power of two edge length of the tiles.
+	 */
+	const std::complex<float>* Spectrum(unsigned int tile);
+};
+
+/**
+ * Chooses the evaluation of convolve() by estimated cost.
+ * @param kernel Kernel to filter with.
+ * @param resX Width of the image.
+ * @param resY Height of the image.
+ * @returns Edge length of the tiles of the frequency domain path, or 0 if
+ * the direct sum is cheaper.
+ */
+unsigned int convolution_tile(const ConvolutionKernel& kernel, int resX,
+		int resY);
+
+/**
+ * Filters an image: out(x, y) = sum over the kernel pixels (i, j) of
+ * weights[j * width + i] * in(x + i - centerX, y + j - centerY).
+ * @param out Output parameter. Contains the filtered image. Must not be in.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param kernel Kernel to filter with.
+ * @param border ConvolutionBorder.
+ * @param method ConvolutionMethod.
+ */
+void convolve(Vec3* out, const Vec3* in, const int resX, const int resY,
+		ConvolutionKernel& kernel, int border = BORDER_NORMALIZE,
+		int method = CONVOLUTION_AUTO);
+
+/**
+ * Filters an image with the separable kernel weightsY^T * weightsX, see
+ * convolve(). Costs sizeX + sizeY instead of sizeX * sizeY operations per
+ * pixel.
+ * @remarks Both passes run over padded rows of floats, so the compiler
+ * vectorizes them across pixels. The column pass works on vertical strips
+ * of CONVOLUTION_STRIP pixels that are filtered in parallel (OPENMP).
+ * @param out Output parameter. Contains the filtered image. May be in.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param weightsX sizeX weights of the row pass, centered at sizeX / 2.
+ * @param sizeX Number of weights of the row pass.
+ * @param weightsY sizeY weights of the column pass, centered at sizeY / 2.
+ * @param sizeY Number of weights of the column pass.
+ * @param border ConvolutionBorder.
+ */
+void convolve_separable(Vec3* out, const Vec3* in, const int resX,
+		const int resY, const float* weightsX, int sizeX, const float* weightsY,
+		int sizeY, int border = BORDER_NORMALIZE);
+
+#endif
@@ -0,0 +1,435 @@
+/**
+ * Fast Fourier Transformation, see fft.h.
+ */
+
+#include "fft.h"
+#include <cmath>
+
+using namespace std;
+
+/**
+ * Precomputed tables for 1d transforms of one length.
+ */
+struct Fft1d
+{
+	/// Length of the transform.
+	unsigned int n;
+	/// log2(n) if n is a power of two, -1 otherwise.
+	int log2n;
+	/// exp(-2 pi i k / n) for k < n (power of two lengths).
+	complex<float>* twiddles;
+	/// Bit reversed index of every k < n (power of two lengths).
+	unsigned int* bitrev;
+	/// Power of two transform of length m >= 2n - 1 (Bluestein).
+	Fft1d* pow2;
+	/// exp(-pi i k^2 / n) for k < n (Bluestein).
+	complex<float>* chirp;
+	/// Spectrum of the conjugate chirp wrapped to length m, divided by m (Bluestein).
+	complex<float>* kernel;
+};
+
+static Fft1d* fft_create(unsigned int n);
+
+/// Frees the tables of a transform.
+static void fft_destroy(Fft1d* p)
+{
+	if (!p)
+		return;
+	delete[] p->twiddles;
+	delete[] p->bitrev;
+	delete[] p->chirp;
+	delete[] p->kernel;
+	fft_destroy(p->pow2);
+	delete p;
+}
+
+/**
+ * In place transform of a power of two length.
+ * @param p Tables with log2n >= 0.
+ * @param x p->n values.
+ * @param sign -1 for the forward, +1 for the inverse transformation.
+ */
+static void fft_pow2(const Fft1d* p, complex<float>* x, int sign)
+{
+	unsigned int n = p->n;
+	for (unsigned int k = 0; k < n; k++)
+	{
+		unsigned int r = p->bitrev[k];
+		if (r > k)
+			swap(x[k], x[r]);
+	}
+
+	unsigned int m = 1;
+	if (p->log2n & 1)
+	{
+		// Odd exponent: one radix-2 pass, the rest is radix-4.
+		for (unsigned int k = 0; k < n; k += 2)
+		{
+			complex<float> a = x[k], b = x[k + 1];
+			x[k] = a + b;
+			x[k + 1] = a - b;
+		}
+		m = 2;
+	}
+
+	for (; m < n; m *= 4)
+	{
+		// Combines 4 transforms of length m into one of length 4m. After the
+		// bit reversal the blocks hold the residues 0, 2, 1, 3 modulo 4.
+		unsigned int stride = n / (4 * m);
+		for (unsigned int b = 0; b < n; b += 4 * m)
+		{
+			complex<float>* x0 = x + b;
+			complex<float>* x1 = x0 + m;
+			complex<float>* x2 = x1 + m;
+			complex<float>* x3 = x2 + m;
+			for (unsigned int k = 0; k < m; k++)
+			{
+				complex<float> w1 = p->twiddles[k * stride];
+				complex<float> w2 = p->twiddles[2 * k * stride];
+				complex<float> w3 = p->twiddles[3 * k * stride];
+				if (sign > 0)
+				{
+					w1 = conj(w1);
+					w2 = conj(w2);
+					w3 = conj(w3);
+				}
+				complex<float> t0 = x0[k];
+				complex<float> t1 = x1[k] * w2;
+				complex<float> t2 = x2[k] * w1;
+				complex<float> t3 = x3[k] * w3;
+
+				complex<float> s0 = t0 + t1, d0 = t0 - t1;
+				complex<float> s1 = t2 + t3, d1 = t2 - t3;
+				// Multiplication with sign * i.
+				d1 = sign > 0 ? complex<float>(-d1.imag(), d1.real()) :
+						complex<float>(d1.imag(), -d1.real());
+
+				x0[k] = s0 + s1;
+				x1[k] = d0 + d1;
+				x2[k] = s0 - s1;
+				x3[k] = d0 - d1;
+			}
+		}
+	}
+}
+
+/**
+ * In place transform of any length.
+ * @param p Tables of the length.
+ * @param x p->n values.
+ * @param sign -1 for the forward, +1 for the inverse transformation.
+ * @param work p->pow2->n values of scratch memory for Bluestein lengths.
+ */
+static void fft_1d(const Fft1d* p, complex<float>* x, int sign,
+		complex<float>* work)
+{
+	if (p->log2n >= 0)
+	{
+		fft_pow2(p, x, sign);
+		return;
+	}
+
+	// Bluestein: jk = (j^2 + k^2 - (k - j)^2) / 2 turns the transform into a
+	// convolution with the chirp, which is evaluated with power of two FFTs.
+	// The inverse uses the conjugate chirp and the mirrored conjugate kernel.
+	unsigned int n = p->n;
+	unsigned int m = p->pow2->n;
+	for (unsigned int k = 0; k < n; k++)
+		work[k] = x[k] * (sign > 0 ? conj(p->chirp[k]) : p->chirp[k]);
+	for (unsigned int k = n; k < m; k++)
+		work[k] = 0.0f;
+
+	fft_pow2(p->pow2, work, -1);
+	if (sign > 0)
+		for (unsigned int k = 0; k < m; k++)
+			work[k] *= conj(p->kernel[(m - k) & (m - 1)]);
+	else
+		for (unsigned int k = 0; k < m; k++)
+			work[k] *= p->kernel[k];
+	fft_pow2(p->pow2, work, 1);
+
+	for (unsigned int k = 0; k < n; k++)
+		x[k] = work[k] * (sign > 0 ? conj(p->chirp[k]) : p->chirp[k]);
+}
+
+/**
+ * Precomputes the tables for transforms of length n.
+ */
+static Fft1d* fft_create(unsigned int n)
+{
+	Fft1d* p = new Fft1d;
+	p->n = n;
+	p->log2n = -1;
+	p->twiddles = 0;
+	p->bitrev = 0;
+	p->pow2 = 0;
+	p->chirp = 0;
+	p->kernel = 0;
+
+	if ((n & (n - 1)) == 0)
+	{
+		p->log2n = 0;
+		while ((1u << p->log2n) < n)
+			p->log2n++;
+		p->twiddles = new complex<float> [n];
+		p->bitrev = new unsigned int[n];
+		for (unsigned int k = 0; k < n; k++)
+		{
+			// Computed in double, so the error does not grow with the index.
+			double a = -2.0 * M_PI * k / n;
+			p->twiddles[k] = complex<float>(cos(a), sin(a));
+			unsigned int r = 0;
+			for (int b = 0; b < p->log2n; b++)
+				r |= ((k >> b) & 1) << (p->log2n - 1 - b);
+			p->bitrev[k] = r;
+		}
+		return p;
+	}
+
+	unsigned int m = 1;
+	while (m < 2 * n - 1)
+		m *= 2;
+	p->pow2 = fft_create(m);
+
+	p->chirp = new complex<float> [n];
+	for (unsigned int k = 0; k < n; k++)
+	{
+		// k^2 mod 2n keeps the angle small and exact.
+		unsigned long long k2 = (unsigned long long) k * k % (2ull * n);
+		double a = -M_PI * k2 / n;
+		p->chirp[k] = complex<float>(cos(a), sin(a));
+	}
+
+	p->kernel = new complex<float> [m];
+	for (unsigned int k = 0; k < m; k++)
+		p->kernel[k] = 0.0f;
+	p->kernel[0] = conj(p->chirp[0]) / (float) m;
+	for (unsigned int k = 1; k < n; k++)
+		p->kernel[k] = p->kernel[m - k] = conj(p->chirp[k]) / (float) m;
+	fft_pow2(p->pow2, p->kernel, -1);
+	return p;
+}
+
+/// Size of the scratch memory fft_1d() needs for a length.
+static unsigned int fft_work_size(const Fft1d* p)
+{
+	return p->pow2 ? p->pow2->n : 0;
+}
+
+/**
+ * Transforms rows of an array in place, in parallel batches.
+ * @param p Tables of the row length.
+ * @param data First row.
+ * @param rows Number of rows.
+ * @param stride Distance of two rows in values.
+ * @param sign -1 for the forward, +1 for the inverse transformation.
+ */
+static void fft_rows(const Fft1d* p, complex<float>* data, unsigned int rows,
+		unsigned int stride, int sign)
+{
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		complex<float>* work = new complex<float> [fft_work_size(p)];
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int r = 0; r < (int) rows; r++)
+			fft_1d(p, data + (long) r * stride, sign, work);
+		delete[] work;
+	}
+}
+
+/**
+ * Transposes and scales a rows x cols array in FFT_BLOCK x FFT_BLOCK
+ * blocks, so reads and writes both stay within a few cache lines.
+ * @param dst Out parameter: cols rows of dstStride values.
+ * @param dstStride Distance of two rows of dst in values.
+ * @param src rows rows of srcStride values.
+ * @param srcStride Distance of two rows of src in values.
+ * @param scale Factor applied to every value.
+ */
+static void fft_transpose(complex<float>* dst, unsigned int dstStride,
+		const complex<float>* src, unsigned int srcStride, unsigned int rows,
+		unsigned int cols, float scale)
+{
+#ifdef OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (int bi = 0; bi < (int) rows; bi += FFT_BLOCK)
+	{
+		unsigned int iEnd = bi + FFT_BLOCK < (int) rows ? bi + FFT_BLOCK : rows;
+		for (unsigned int bj = 0; bj < cols; bj += FFT_BLOCK)
+		{
+			unsigned int jEnd = bj + FFT_BLOCK < cols ? bj + FFT_BLOCK : cols;
+			for (unsigned int i = bi; i < iEnd; i++)
+				for (unsigned int j = bj; j < jEnd; j++)
+					dst[(long) j * dstStride + i] = src[(long) i * srcStride + j]
+							* scale;
+		}
+	}
+}
+
+FFTPlan::FFTPlan(unsigned int resX, unsigned int resY) :
+		resX(resX), resY(resY), next(0)
+{
+	rows = fft_create(resY);
+	cols = fft_create(resX);
+}
+
+FFTPlan::~FFTPlan()
+{
+	fft_destroy(rows);
+	fft_destroy(cols);
+}
+
+void FFTPlan::execute(complex<float>* out, const complex<float>* in, int sign)
+{
+	unsigned int size = resX * resY;
+	if (out != in)
+		for (unsigned int i = 0; i < size; i++)
+			out[i] = in[i];
+
+	complex<float>* transposed = new complex<float> [size];
+	fft_rows(rows, out, resX, resY, sign);
+	fft_transpose(transposed, resX, out, resY, resX, resY, 1.0f);
+	fft_rows(cols, transposed, resY, resX, sign);
+	fft_transpose(out, resY, transposed, resX, resY, resX,
+			1.0f / sqrtf((float) resX * (float) resY));
+	delete[] transposed;
+}
+
+void FFTPlan::forwardReal(complex<float>* out, const float* in)
+{
+	unsigned int half = fft_half(resY);
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		complex<float>* work = new complex<float> [fft_work_size(rows)];
+		complex<float>* z = new complex<float> [resY];
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int x = 0; x < (int) resX; x += 2)
+		{
+			// Rows a and b are transformed as z = a + i b. Then
+			// A[k] = (Z[k] + conj(Z[-k])) / 2 and B[k] = (Z[k] - conj(Z[-k])) / 2i.
+			const float* a = in + (long) x * resY;
+			const float* b = x + 1 < (int) resX ? a + resY : 0;
+			for (unsigned int n = 0; n < resY; n++)
+				z[n] = complex<float>(a[n], b ? b[n] : 0.0f);
+			fft_1d(rows, z, -1, work);
+
+			complex<float>* A = out + (long) x * half;
+			for (unsigned int k = 0; k < half; k++)
+			{
+				complex<float> zk = z[k];
+				complex<float> zm = conj(z[(resY - k) % resY]);
+				A[k] = (zk + zm) * 0.5f;
+				if (b)
+					A[half + k] = (zk - zm) * complex<float>(0.0f, -0.5f);
+			}
+		}
+		delete[] z;
+		delete[] work;
+	}
+
+	// Columns are complex, but only half of them are left.
+	complex<float>* transposed = new complex<float> [half * resX];
+	fft_transpose(transposed, resX, out, half, resX, half, 1.0f);
+	fft_rows(cols, transposed, half, resX, -1);
+	fft_transpose(out, half, transposed, resX, half, resX,
+			1.0f / sqrtf((float) resX * (float) resY));
+	delete[] transposed;
+}
+
+void FFTPlan::inverseReal(float* out, complex<float>* in)
+{
+	unsigned int half = fft_half(resY);
+	complex<float>* transposed = new complex<float> [half * resX];
+	fft_transpose(transposed, resX, in, half, resX, half, 1.0f);
+	fft_rows(cols, transposed, half, resX, 1);
+	fft_transpose(in, half, transposed, resX, half, resX,
+			1.0f / sqrtf((float) resX * (float) resY));
+	delete[] transposed;
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		complex<float>* work = new complex<float> [fft_work_size(rows)];
+		complex<float>* z = new complex<float> [resY];
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int x = 0; x < (int) resX; x += 2)
+		{
+			// Two Hermitian rows are restored at once from Z = A + i B.
+			const complex<float>* A = in + (long) x * half;
+			const complex<float>* B = x + 1 < (int) resX ? A + half : 0;
+			for (unsigned int k = 0; k < resY; k++)
+			{
+				bool stored = k < half;
+				unsigned int j = stored ? k : resY - k;
+				complex<float> a = stored ? A[j] : conj(A[j]);
+				complex<float> b = B ? (stored ? B[j] : conj(B[j])) : 0.0f;
+				z[k] = a + complex<float>(-b.imag(), b.real());
+			}
+			fft_1d(rows, z, 1, work);
+
+			float* a = out + (long) x * resY;
+			for (unsigned int n = 0; n < resY; n++)
+				a[n] = z[n].real();
+			if (B)
+				for (unsigned int n = 0; n < resY; n++)
+					a[resY + n] = z[n].imag();
+		}
+		delete[] z;
+		delete[] work;
+	}
+}
+
+FFTPlan* FFTPlan::get(unsigned int resX, unsigned int resY)
+{
+	static FFTPlan* plans = 0;
+
+	FFTPlan* plan = 0;
+#ifdef OPENMP
+#pragma omp critical(fft_plans)
+#endif
+	{
+		plan = plans;
+		while (plan && (plan->resX != resX || plan->resY != resY))
+			plan = plan->next;
+		if (!plan)
+		{
+			// Plans hold only O(resX + resY) tables, so they are never freed.
+			plan = new FFTPlan(resX, resY);
+			plan->next = plans;
+			plans = plan;
+		}
+	}
+	return plan;
+}
+
+void fft2d(complex<float>* out, const complex<float>* in, unsigned int resX,
+		unsigned int resY, int sign)
+{
+	FFTPlan::get(resX, resY)->execute(out, in, sign);
+}
+
+void fft2d_r2c(complex<float>* out, const float* in, unsigned int resX,
+		unsigned int resY)
+{
+	FFTPlan::get(resX, resY)->forwardReal(out, in);
+}
+
+void fft2d_c2r(float* out, complex<float>* in, unsigned int resX,
+		unsigned int resY)
+{
+	FFTPlan::get(resX, resY)->inverseReal(out, in);
+}
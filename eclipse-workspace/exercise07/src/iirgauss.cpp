@@ -0,0 +1,298 @@
+/**
+ * Recursive gauss filters, see iirgauss.h.
+ */
+
+#include "iirgauss.h"
+#include "convolution.h"
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+/**
+ * Coefficients of a pair of recursions
+ *   causal:      y(p) = sum n[k] x(p - k) - sum d[k] y(p - k)
+ *   anti-causal: z(p) = sum m[k] u(p + k) - sum d[k] z(p + k)
+ * with u = y and the result z if cascade, u = x and the result y + z
+ * otherwise. d[0] is 1.
+ * @remarks For large sigma the poles approach 1 and the sum of d cancels to
+ * about sigma^-4, so coefficients and the states of the recursions need
+ * double precision.
+ */
+struct IirCoefficients
+{
+	double n[4];
+	double m[5];
+	double d[5];
+	bool cascade;
+};
+
+/// Multiplies the polynomials a (size na) and b (size nb) into c.
+static void poly_mul(double* c, const double* a, int na, const double* b,
+		int nb)
+{
+	for (int i = 0; i < na + nb - 1; i++)
+		c[i] = 0.0;
+	for (int i = 0; i < na; i++)
+		for (int j = 0; j < nb; j++)
+			c[i + j] += a[i] * b[j];
+}
+
+/**
+ * Deriche's approximation of the gauss function,
+ * h(x) = (a0 cos(w0 x) + a1 sin(w0 x)) e^(-b0 x) + (c0 cos(w1 x) + c1 sin(w1 x))
+ * e^(-b1 x) for x = |t| / sigma, as the sum of a causal (t >= 0) and an
+ * anti-causal (t < 0) recursion. The coefficients follow from the z
+ * transforms of the two damped oscillations.
+ */
+static IirCoefficients deriche_coefficients(float sigma)
+{
+	const double a[2] = { 1.6800, -0.6803 };
+	const double b[2] = { 3.7350, -0.2598 };
+	const double decay[2] = { 1.7830, 1.7230 };
+	const double omega[2] = { 0.6318, 1.9970 };
+
+	// Numerator and denominator of the transform of one oscillation:
+	// (A + r (B sin - A cos) z^-1) / (1 - 2 r cos z^-1 + r^2 z^-2)
+	double num[2][2], den[2][3];
+	for (int i = 0; i < 2; i++)
+	{
+		double r = exp(-decay[i] / sigma);
+		double c = cos(omega[i] / sigma);
+		double s = sin(omega[i] / sigma);
+		num[i][0] = a[i];
+		num[i][1] = r * (b[i] * s - a[i] * c);
+		den[i][0] = 1.0;
+		den[i][1] = -2.0 * r * c;
+		den[i][2] = r * r;
+	}
+	double n[4], n1[4], d[5];
+	poly_mul(n, num[0], 2, den[1], 3);
+	poly_mul(n1, num[1], 2, den[0], 3);
+	poly_mul(d, den[0], 3, den[1], 3);
+
+	// The anti-causal part starts at t = 1: m = n - h(0) d.
+	double m[5];
+	double sumN = 0.0, sumM = 0.0, sumD = 0.0;
+	for (int k = 0; k < 5; k++)
+	{
+		if (k < 4)
+			n[k] += n1[k];
+		m[k] = (k < 4 ? n[k] : 0.0) - n[0] * d[k];
+		sumD += d[k];
+	}
+	for (int k = 0; k < 5; k++)
+	{
+		sumN += k < 4 ? n[k] : 0.0;
+		sumM += m[k];
+	}
+
+	// Normalizes the integral of the impulse response to 1.
+	double scale = sumD / (sumN + sumM);
+	IirCoefficients coeffs;
+	for (int k = 0; k < 5; k++)
+	{
+		if (k < 4)
+			coeffs.n[k] = n[k] * scale;
+		coeffs.m[k] = m[k] * scale;
+		coeffs.d[k] = d[k];
+	}
+	coeffs.cascade = false;
+	return coeffs;
+}
+
+/**
+ * Young and van Vliet's 3rd order approximation of the gauss function,
+ * applied forwards and then backwards.
+ */
+static IirCoefficients young_coefficients(float sigma)
+{
+	double q = sigma >= 2.5f ? 0.98711 * sigma - 0.96330 :
+			3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+	double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+	double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+	double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+	double b3 = 0.422205 * q * q * q;
+	double B = 1.0 - (b1 + b2 + b3) / b0;
+
+	IirCoefficients coeffs;
+	memset(&coeffs, 0, sizeof(coeffs));
+	coeffs.n[0] = B;
+	coeffs.m[0] = B;
+	coeffs.d[0] = 1.0;
+	coeffs.d[1] = -b1 / b0;
+	coeffs.d[2] = -b2 / b0;
+	coeffs.d[3] = -b3 / b0;
+	coeffs.cascade = true;
+	return coeffs;
+}
+
+/**
+ * Filters the columns of an array of floats.
+ * @param out width * height values. May be in.
+ * @param in width * height values, row by row.
+ * @param pad Number of mirrored rows the recursions run through before
+ * they reach the array.
+ */
+static void iir_columns(float* out, const float* in, int width, int height,
+		const IirCoefficients& c, int pad)
+{
+	const int strip = 3 * IIR_STRIP;
+	const int numStrips = (width + strip - 1) / strip;
+	// Rows -pad .. height + pad + 3 of the causal result, the input of the
+	// anti-causal recursion of a cascade.
+	const int rows = height + 2 * pad + 4;
+	const int first = -pad;
+	const int last = height + pad - 1;
+	double sumN = c.n[0] + c.n[1] + c.n[2] + c.n[3];
+	double sumM = c.m[0] + c.m[1] + c.m[2] + c.m[3] + c.m[4];
+	double sumD = c.d[0] + c.d[1] + c.d[2] + c.d[3] + c.d[4];
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		// The stored results are float; only the last 4 results of each
+		// recursion, its state, are kept in double precision.
+		float* Y = new float[rows * strip];
+		float* Z = new float[height * strip];
+		double* state = new double[5 * strip];
+
+#ifdef OPENMP
+#pragma omp for
+#endif
+		for (int s = 0; s < numStrips; s++)
+		{
+			int x0 = s * strip;
+			int n = x0 + strip < width ? strip : width - x0;
+#define X(p) (in + (long) border_coord((p) < first ? first : ((p) > last ? last : (p)), height, BORDER_MIRROR) * width + x0)
+#define ROW_Y(p) (Y + ((p) + pad) * strip)
+#define STATE(p) (state + (((p) % 5 + 5) % 5) * strip)
+
+			// The input is taken as constant before the first row, so the
+			// causal recursion starts in its steady state.
+			for (int k = 1; k <= 4; k++)
+			{
+				const float* x = X(first);
+				double* y = STATE(first - k);
+				for (int j = 0; j < n; j++)
+					y[j] = x[j] * sumN / sumD;
+			}
+			for (int p = first; p <= last; p++)
+			{
+				const float* x0r = X(p);
+				const float* x1r = X(p - 1);
+				const float* x2r = X(p - 2);
+				const float* x3r = X(p - 3);
+				const double* y1 = STATE(p - 1);
+				const double* y2 = STATE(p - 2);
+				const double* y3 = STATE(p - 3);
+				const double* y4 = STATE(p - 4);
+				double* y = STATE(p);
+				float* result = ROW_Y(p);
+				for (int j = 0; j < n; j++)
+				{
+					y[j] = c.n[0] * x0r[j] + c.n[1] * x1r[j] + c.n[2] * x2r[j]
+							+ c.n[3] * x3r[j] - c.d[1] * y1[j] - c.d[2] * y2[j]
+							- c.d[3] * y3[j] - c.d[4] * y4[j];
+					result[j] = (float) y[j];
+				}
+			}
+
+			// The anti-causal recursion runs over the input or, for a
+			// cascade, over the causal result, and starts in its steady state
+			// after the last row as well.
+			for (int k = 1; k <= 4; k++)
+			{
+				const float* uEnd = c.cascade ? ROW_Y(last) : X(last);
+				float* u = ROW_Y(last + k);
+				double* z = STATE(last + k);
+				for (int j = 0; j < n; j++)
+				{
+					if (c.cascade)
+						u[j] = uEnd[j];
+					z[j] = uEnd[j] * sumM / sumD;
+				}
+			}
+			for (int p = last; p >= 0; p--)
+			{
+				const float* u0 = c.cascade ? ROW_Y(p) : X(p);
+				const float* u1 = c.cascade ? ROW_Y(p + 1) : X(p + 1);
+				const float* u2 = c.cascade ? ROW_Y(p + 2) : X(p + 2);
+				const float* u3 = c.cascade ? ROW_Y(p + 3) : X(p + 3);
+				const float* u4 = c.cascade ? ROW_Y(p + 4) : X(p + 4);
+				const double* z1 = STATE(p + 1);
+				const double* z2 = STATE(p + 2);
+				const double* z3 = STATE(p + 3);
+				const double* z4 = STATE(p + 4);
+				double* z = STATE(p);
+				for (int j = 0; j < n; j++)
+					z[j] = c.m[0] * u0[j] + c.m[1] * u1[j] + c.m[2] * u2[j]
+							+ c.m[3] * u3[j] + c.m[4] * u4[j] - c.d[1] * z1[j]
+							- c.d[2] * z2[j] - c.d[3] * z3[j] - c.d[4] * z4[j];
+				if (p < height)
+				{
+					const float* y = ROW_Y(p);
+					float* result = Z + p * strip;
+					if (c.cascade)
+						for (int j = 0; j < n; j++)
+							result[j] = (float) z[j];
+					else
+						for (int j = 0; j < n; j++)
+							result[j] = (float) (y[j] + z[j]);
+				}
+			}
+
+			// All reads of the strip are done, so out may be in.
+			for (int p = 0; p < height; p++)
+				memcpy(out + (long) p * width + x0, Z + p * strip,
+						n * sizeof(float));
+#undef X
+#undef ROW_Y
+#undef STATE
+		}
+
+		delete[] Y;
+		delete[] Z;
+		delete[] state;
+	}
+}
+
+/// Transposes a rows x cols image in IIR_BLOCK x IIR_BLOCK blocks.
+static void iir_transpose(Vec3* dst, const Vec3* src, int rows, int cols)
+{
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int bi = 0; bi < rows; bi += IIR_BLOCK)
+	{
+		int iEnd = bi + IIR_BLOCK < rows ? bi + IIR_BLOCK : rows;
+		for (int bj = 0; bj < cols; bj += IIR_BLOCK)
+		{
+			int jEnd = bj + IIR_BLOCK < cols ? bj + IIR_BLOCK : cols;
+			for (int i = bi; i < iEnd; i++)
+				for (int j = bj; j < jEnd; j++)
+					dst[(long) j * rows + i] = src[(long) i * cols + j];
+		}
+	}
+}
+
+void iir_gauss(Vec3* out, const Vec3* in, const int resX, const int resY,
+		float sigma, int type)
+{
+	IirCoefficients c = type == IIR_YOUNG ? young_coefficients(sigma) :
+			deriche_coefficients(sigma);
+	// The recursions need about 4 sigma to forget their initial state; more
+	// than a few mirrored copies of the image would not change the result.
+	int pad = (int) ceilf(4.0f * sigma);
+
+	Vec3* transposed = new Vec3[resX * resY];
+	iir_transpose(transposed, in, resY, resX);
+	iir_columns((float*) transposed, (const float*) transposed, 3 * resY, resX,
+			c, pad < 4 * resX ? pad : 4 * resX);
+	iir_transpose(out, transposed, resX, resY);
+	delete[] transposed;
+
+	iir_columns((float*) out, (const float*) out, 3 * resX, resY, c,
+			pad < 4 * resY ? pad : 4 * resY);
+}
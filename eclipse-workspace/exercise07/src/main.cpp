@@ -1,11 +1,18 @@
 #include <iostream>
 #include "fileio.h"
 #include "vec.h"
+#include "convolution.h"
+#include "iirgauss.h"
+#include "median.h"
+#include "bilateral.h"
+#include "atrous.h"
+#include "boxfilter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <vector>
 #include <algorithm>
 #include <math.h>
+#include <sys/time.h>
 
 // HINT:
 // Build with "scons openmp=1" for performance.
@@ -31,6 +38,24 @@ inline float sq(float v)
 	return v * v;
 }
 
+/// Wall clock time in seconds.
+static double wall_time()
+{
+	timeval t;
+	gettimeofday(&t, 0);
+	return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+/// Root mean square difference of the channels of two images.
+static float rms_difference(const Vec3* a, const Vec3* b, const int numPixels)
+{
+	double sum = 0.0;
+	for (int p = 0; p < numPixels; p++)
+		for (int c = 0; c < 3; c++)
+			sum += sq(a[p][c] - b[p][c]);
+	return (float) sqrt(sum / (3.0 * numPixels));
+}
+
 /**
  * Evaluates the gauss function.
  * @param d Distance to the peak of the gauss function.
@@ -42,44 +67,109 @@ inline float gauss(const float d, const float sigma)
 	return expf(-0.5f * sq(d / sigma));
 }
 
+/**
+ * Evaluation of GaussianFilter().
+ */
+enum GaussianMethod
+{
+	/// Kernel cut off at 3 sigma, O(sigma) per pixel.
+	GAUSSIAN_FIR,
+	/// Recursive filter, O(1) per pixel, see IIR_DERICHE.
+	GAUSSIAN_DERICHE,
+	/// Faster and less accurate recursive filter, see IIR_YOUNG.
+	GAUSSIAN_YOUNG
+};
+
 /**
  * Filters an image with a gauss filter.
+ * @remarks The image is mirrored at its border.
  * @param out Output parameter. Contains the filtered image.
  * @param in Image to process.
  * @param resX Width of the images in in/out in pixels.
  * @param resY Height of the images in in/out in pixels.
  * @param sigma Sigma of the gauss kernel to use.
+ * @param method GaussianMethod. The recursive filters pay off for large sigma
+ * (about 10 and more). If sigma exceeds the width or height of the image,
+ * GAUSSIAN_FIR is used, see IirGaussType.
  */
 void GaussianFilter(Vec3* out, const Vec3* in, const int resX, const int resY,
-		float sigma)
+		float sigma, int method = GAUSSIAN_FIR)
 {
 	// TODO 7.1 a) Implement a gaussian filter.
-	Vec3* rowGauss = new Vec3[resX * resY];
-	for(int pos =0; pos < resX * resY; pos++) {
-			Vec3 value= Vec3(0.0f);
-			float normalization=0.0f;
-			int row_pos=pos%resY;
-			for(int i = -row_pos; i <= resY-row_pos; i++){
-					value += in[pos+i]*gauss(i, sigma);
-					normalization+=gauss(i, sigma);
-			}
-			rowGauss[pos]=value/normalization;
+	// The recursions are inaccurate on images smaller than sigma, where the
+	// kernel is cheap anyway.
+	if (method != GAUSSIAN_FIR && sigma <= resX && sigma <= resY)
+	{
+		iir_gauss(out, in, resX, resY, sigma,
+				method == GAUSSIAN_YOUNG ? IIR_YOUNG : IIR_DERICHE);
+		return;
 	}
 
-	for(int pos =0; pos < resX * resY; pos++) {
-			Vec3 value= Vec3(0.0f);
-			float normalization=0.0f;
-			int col_pos=(int)pos/resY;
-			for(int i = -col_pos; i <= resY-col_pos; i++){
-					value += rowGauss[pos+i*resY]*gauss(i, sigma);
-					normalization+=gauss(i, sigma);
-			}
-			out[pos]=value/normalization;
+	// The 2d gauss function is the product of two 1d ones, so the image is
+	// filtered by rows and by columns with a kernel cut off at 3 sigma.
+	int radius = (int) ceilf(3.0f * sigma);
+	int size = 2 * radius + 1;
+	float* weights = new float[size];
+	float sum = 0.0f;
+	for (int i = 0; i < size; i++)
+	{
+		weights[i] = gauss(i - radius, sigma);
+		sum += weights[i];
 	}
+	for (int i = 0; i < size; i++)
+		weights[i] /= sum;
+
+	convolve_separable(out, in, resX, resY, weights, size, weights, size,
+			BORDER_MIRROR);
+	delete[] weights;
+}
+
+/**
+ * Filters an image with a disk shaped kernel, as an out of focus lens
+ * would.
+ * @remarks The kernel is not separable, so it goes through convolve(),
+ * which takes the frequency domain path for all but small radii. The
+ * image is mirrored at its border.
+ * @param out Output parameter. Contains the filtered image.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param radius Radius of the disk in pixels.
+ */
+void DiskFilter(Vec3* out, const Vec3* in, const int resX, const int resY,
+		float radius)
+{
+	// Pixels are weighted by the part of their area inside the disk,
+	// estimated with 4x4 subsamples, so the edge of the disk is smooth.
+	int r = (int) ceilf(radius);
+	int size = 2 * r + 1;
+	float* weights = new float[size * size];
+	float sum = 0.0f;
+	for (int j = 0; j < size; j++)
+		for (int i = 0; i < size; i++)
+		{
+			int covered = 0;
+			for (int s = 0; s < 16; s++)
+			{
+				float dx = i - r + ((s & 3) + 0.5f) / 4.0f - 0.5f;
+				float dy = j - r + ((s >> 2) + 0.5f) / 4.0f - 0.5f;
+				covered += dx * dx + dy * dy <= radius * radius;
+			}
+			weights[j * size + i] = covered / 16.0f;
+			sum += weights[j * size + i];
+		}
+	for (int i = 0; i < size * size; i++)
+		weights[i] /= sum;
+
+	ConvolutionKernel kernel(size, size, weights);
+	delete[] weights;
+	convolve(out, in, resX, resY, kernel, BORDER_MIRROR);
 }
 
 /**
  * Filters an image with a median filter.
+ * @remarks The image is mirrored at its border. Even sizes of the box are
+ * rounded up to the next odd one.
  * @param out Output parameter. Contains the filtered image.
  * @param in Image to process.
  * @param resX Width of the images in in/out in pixels.
@@ -90,37 +180,7 @@ void MedianFilter(Vec3* out, const Vec3* in, const int resX, const int resY,
 		const int widthHeight)
 {
 	// TODO 7.1 b) Implement a median filter.
-	// You may want to utilize the MIN/MAX macros for looping over the filter area.
-
-
-
-	// as not specified otherwise, we use no padding and the image would get cropped to a resolution of (resX-WidthHeight)*(resY-WidthHeight)
-	// to retain image size, we pad those pixels black
-
-	for(int i=0; i<resX*resY;i++){
-		out[i]=Vec3(0.0f);
-	}
-
-	int bound=(int) (widthHeight/2);
-	for(int posX=bound; posX<resX-bound; posX++){
-		for(int posY=bound; posY<resY-bound; posY++){
-			std::vector<float> values_x;
-			std::vector<float> values_y;
-			std::vector<float> values_z;
-			for(int row=-bound; row <= bound; row++){
-				for(int col=-bound; col <= bound; col++){
-					values_x.push_back(in[posX+row+resY*(posY+col)].x);
-					values_y.push_back(in[posX+row+resY*(posY+col)].y);
-					values_z.push_back(in[posX+row+resY*(posY+col)].z);
-				}
-			}
-			std::sort (values_x.begin(), values_x.end());
-			std::sort (values_y.begin(), values_y.end());
-			std::sort (values_z.begin(), values_z.end());
-
-			out[posX+posY*resY]=Vec3(values_x[bound], values_y[bound], values_z[bound]);
-		}
-	}
+	median_filter(out, in, resX, resY, widthHeight / 2, BORDER_MIRROR);
 }
 
 /**
@@ -136,22 +196,8 @@ void BilateralFilter(Vec3* out, const Vec3* in, const int resX, const int resY,
 		const float sigmaG, const float sigmaB)
 {
 	// TODO 7.1 c) Implement a bilateral filter.
-	int bound = (int) sigmaG*3;
-	for(int posX=0; posX<resX; posX++){
-		for(int posY=0; posY<resY; posY++){
-			Vec3 value= Vec3(0.0f);
-			float normalization=0.0f;
-
-			for(int row=MAX(0,posX-bound); row < MIN(resX, posX+bound); row++){
-				for(int col=MAX(0,posY-bound); col < MIN(resY, posY+bound); col++){
-					value+=in[row+resY*col]*gauss(sqrt(sq(row-posX)+sq(col-posY)), sigmaG)*gauss((in[row+resY*col]-in[posX+resY*posY]).length(), sigmaB);
-					normalization+=gauss(sqrt(sq(row-posX)+sq(col-posY)), sigmaG)*gauss((in[row+resY*col]-in[posX+resY*posY]).length(), sigmaB);
-				}
-			}
-			out[posX+resY*posY]=value/normalization;
-		}
-	}
-
+	BilateralWeights weights(sigmaG, sigmaB);
+	bilateral_direct(out, in, resX, resY, weights);
 }
 
 /**
@@ -163,7 +209,7 @@ void BilateralFilter(Vec3* out, const Vec3* in, const int resX, const int resY,
  * @param resX Width of the images in in/out in pixels.
  * @param resY Height of the images in in/out in pixels.
  * @param n Number of levels to create.
- * @param sigmaG Sigma of the gauss kernel for weighting by spatial distance.
+ * @param sigmaG Unused, the spatial weights are the taps of the B3 spline.
  * @param sigmaB Sigma of the gauss kernel for weighting by intensity difference.
  */
 void aTrousTransformation(Vec3** out, const Vec3* in, const int resX,
@@ -171,35 +217,7 @@ void aTrousTransformation(Vec3** out, const Vec3* in, const int resX,
 {
 	// TODO 7.2 a) Implement the A-Trous Wavelet transform.
 	// Ignore the sigmaB parameter for part a) of this exercise.
-	Vec3** c = new Vec3*[n];
-	for (int level = 0; level < n; level++)
-		c[level] = new Vec3[resX * resY];
-
-	for(int pos=0; pos<resX*resY; pos++){
-		c[0][pos]=in[pos];
-	}
-
-	for(int level=1; level<n; level++){
-		int bound =(int) sigmaG*3;
-		for(int posX=0; posX<resX; posX++){
-			for(int posY=0; posY<resY; posY++){
-				Vec3 value= Vec3(0.0f);
-				float normalization=0.0f;
-
-				for(int row=MAX(0,posX-bound); row < MIN(resX, posX+bound); row+=pow(2, level)){
-					for(int col=MAX(0,posY-bound); col < MIN(resY, posY+bound); col+=pow(2, level)){
-						value+=c[level-1][row+resY*col]*gauss(sqrt(sq(row-posX)+sq(col-posY)), sigmaG)*gauss((c[level-1][row+resY*col]-c[level-1][posX+resY*posY]).length(), sigmaB);
-						normalization+=gauss(sqrt(sq(row-posX)+sq(col-posY)), sigmaG)*gauss((c[level-1][row+resY*col]-c[level-1][posX+resY*posY]).length(), sigmaB);
-					}
-				}
-				c[level][posX+resY*posY]=value/normalization;
-				out[level-1][posX+resY*posY]=c[level-1][posX+resY*posY]-c[level][posX+resY*posY];
-			}
-		}
-
-	}
-
-	out[n-1]=c[n-1];
+	atrous_transform(out, in, resX, resY, n, sigmaB);
 
 	// TODO 7.2 c) Include the edge-stopping function into your A-Trous Wavelet transform implementation.
 	// This part uses sigmaB similar to the bilateral filter
@@ -221,23 +239,16 @@ void inverseATrousTransformation(Vec3* out, Vec3** in, const int resX,
 		const int resY, const int n, const float* alpha)
 {
 	// TODO 7.2 b) Implement the reconstruction from wavelet layers.
-	for(int i=0; i<resX*resY; i++){
-		out[i]=Vec3(0.0f);
-	}
-	for(int level=0; level<n-1; level++){
-		for(int posX=0; posX<resX; posX++){
-			for(int posY=0; posY<resY; posY++){
-				out[posX + resY * posY]+=alpha[level]*in[level][posX + resY * posY];
-			}
-		}
-	}
-
-	for(int posX=0; posX<resX; posX++){
-		for(int posY=0; posY<resY; posY++){
-			out[posX + resY * posY]+=in[n-1][posX + resY * posY];
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for(int p=0; p<resX*resY; p++){
+		Vec3 sum=in[n-1][p];
+		for(int level=0; level<n-1; level++){
+			sum+=alpha[level]*in[level][p];
 		}
+		out[p]=sum;
 	}
-
 }
 
 /**
@@ -245,6 +256,7 @@ void inverseATrousTransformation(Vec3* out, Vec3** in, const int resX,
  * and processes it with
  * <ul>
  *  <li>Gauss filtering,</li>
+ *  <li>disk filtering,</li>
  *  <li>median filtering,</li>
  *  <li>bilateral filtering and</li>
  *  <li>a-trous transformation (forward + inverse).</li>
@@ -274,16 +286,55 @@ int main(int argc, char **argv)
 	save_image_ppm("gaussFilteredImage.ppm", (float*) filteredImage, resX,
 			resY);
 
+	// Apply disk filter and save.
+	double start = wall_time();
+	DiskFilter(filteredImage, image, resX, resY, 10.0f);
+	printf("disk filter:             %.3f s\n", wall_time() - start);
+	save_image_ppm("diskFilteredImage.ppm", (float*) filteredImage, resX,
+			resY);
+
 	// Apply median filter and save.
 	MedianFilter(filteredImage, image, resX, resY, 5);
 	save_image_ppm("medianFilteredImage.ppm", (float*) filteredImage, resX,
 			resY);
 
 	// Apply bilateral filter and save.
+	start = wall_time();
 	BilateralFilter(filteredImage, image, resX, resY, 5.0f, 0.1f);
+	double exactTime = wall_time() - start;
 	save_image_ppm("bilateralFilteredImage.ppm", (float*) filteredImage, resX,
 			resY);
 
+	// Compare the approximations of the bilateral filter and the guided
+	// filter (radius 2 sigma, eps sigma^2) to it. The grid weights by
+	// luminance instead of RGB difference, so it differs more.
+	Vec3* fastImage = new Vec3[resX * resY];
+	start = wall_time();
+	bilateral_grid(fastImage, image, resX, resY, 5.0f, 0.1f);
+	double gridTime = wall_time() - start;
+	float gridError = rms_difference(fastImage, filteredImage, resX * resY);
+	save_image_ppm("bilateralGridFilteredImage.ppm", (float*) fastImage, resX,
+			resY);
+	start = wall_time();
+	bilateral_permutohedral(fastImage, image, resX, resY, 5.0f, 0.1f);
+	double latticeTime = wall_time() - start;
+	float latticeError = rms_difference(fastImage, filteredImage, resX * resY);
+	save_image_ppm("bilateralLatticeFilteredImage.ppm", (float*) fastImage,
+			resX, resY);
+	start = wall_time();
+	guided_filter(fastImage, image, image, resX, resY, 10, 0.01f);
+	double guidedTime = wall_time() - start;
+	float guidedError = rms_difference(fastImage, filteredImage, resX * resY);
+	save_image_ppm("guidedFilteredImage.ppm", (float*) fastImage, resX, resY);
+	delete[] fastImage;
+	printf("bilateral filter:        %.3f s\n", exactTime);
+	printf("bilateral grid:          %.3f s, rms difference %.4f\n", gridTime,
+			gridError);
+	printf("permutohedral lattice:   %.3f s, rms difference %.4f\n",
+			latticeTime, latticeError);
+	printf("guided filter:           %.3f s, rms difference %.4f\n",
+			guidedTime, guidedError);
+
 	// Prepare for a-trous transformation
 	const int N = 5;
 
@@ -309,19 +360,22 @@ int main(int argc, char **argv)
 		sprintf(filename, "aTrousLevel%02d.ppm", n);
 		save_image_ppm(filename, (float*) aTrousLevels[n], resX, resY);
 	}
+	for (int n = 0; n < N; n++)
+		delete[] aTrousLevels[n];
+	delete[] aTrousLevels;
 
-	// Apply inverse a-trous transformation and save.
-	inverseATrousTransformation(filteredImage, aTrousLevels, resX, resY, N,
-			alpha);
+	// Apply inverse a-trous transformation and save. The levels are not
+	// needed for it: atrous_filter() adds every detail level to the result
+	// as soon as it is computed, which gives the same image as
+	// inverseATrousTransformation(filteredImage, aTrousLevels, resX, resY, N,
+	// alpha).
+	atrous_filter(filteredImage, image, resX, resY, N, alpha, 0.1f);
 	for (int p = 0; p < resX * resY; p++)
 		filteredImage[p].clamp();
 	save_image_ppm("aTrousTransformedImage.ppm", (float*) filteredImage, resX,
 			resY);
 
 	// Cleanup
-	for (int n = 0; n < N; n++)
-		delete[] aTrousLevels[n];
-	delete[] aTrousLevels;
 	delete[] filteredImage;
 	delete[] image;
 
@@ -0,0 +1,288 @@
+/**
+ * Median filter, see median.h.
+ */
+
+#include "median.h"
+#include "convolution.h"
+#include <cstring>
+
+/**
+ * Histogram of 8 bit values in two levels: 16 coarse bins that count the
+ * values with the same upper 4 bits and the 256 fine bins.
+ */
+struct MedianHistogram
+{
+	unsigned short coarse[16];
+	unsigned short fine[256];
+};
+
+/// Adds the bins of b to a.
+static inline void histogram_add(MedianHistogram& a, const MedianHistogram& b)
+{
+	for (int i = 0; i < 16; i++)
+		a.coarse[i] += b.coarse[i];
+	for (int i = 0; i < 256; i++)
+		a.fine[i] += b.fine[i];
+}
+
+/// Subtracts the bins of b from a.
+static inline void histogram_sub(MedianHistogram& a, const MedianHistogram& b)
+{
+	for (int i = 0; i < 16; i++)
+		a.coarse[i] -= b.coarse[i];
+	for (int i = 0; i < 256; i++)
+		a.fine[i] -= b.fine[i];
+}
+
+/// Returns the value with k values below it.
+static inline int histogram_select(const MedianHistogram& h, int k)
+{
+	int c = 0;
+	while (k >= h.coarse[c])
+		k -= h.coarse[c++];
+	int f = 16 * c;
+	while (k >= h.fine[f])
+		k -= h.fine[f++];
+	return f;
+}
+
+/// Swaps a and b if a > b.
+static inline void sort2(float& a, float& b)
+{
+	float lo = a < b ? a : b;
+	b = a < b ? b : a;
+	a = lo;
+}
+
+/**
+ * Median of 9 values with 19 compare and swaps (Paeth's network).
+ */
+static inline float median9(float* p)
+{
+	sort2(p[1], p[2]);
+	sort2(p[4], p[5]);
+	sort2(p[7], p[8]);
+	sort2(p[0], p[1]);
+	sort2(p[3], p[4]);
+	sort2(p[6], p[7]);
+	sort2(p[1], p[2]);
+	sort2(p[4], p[5]);
+	sort2(p[7], p[8]);
+	sort2(p[0], p[3]);
+	sort2(p[5], p[8]);
+	sort2(p[4], p[7]);
+	sort2(p[3], p[6]);
+	sort2(p[1], p[4]);
+	sort2(p[2], p[5]);
+	sort2(p[4], p[7]);
+	sort2(p[4], p[2]);
+	sort2(p[6], p[4]);
+	sort2(p[4], p[2]);
+	return p[4];
+}
+
+/**
+ * Lower median of n <= 9 values, by insertion sort.
+ */
+static inline float median_small(float* p, int n)
+{
+	for (int i = 1; i < n; i++)
+	{
+		float v = p[i];
+		int j = i;
+		for (; j > 0 && p[j - 1] > v; j--)
+			p[j] = p[j - 1];
+		p[j] = v;
+	}
+	return p[(n - 1) / 2];
+}
+
+/// Exact 3x3 median filter for every ConvolutionBorder.
+static void median3x3(Vec3* out, const Vec3* in, const int resX,
+		const int resY, int border)
+{
+	const bool normalize = border == BORDER_NORMALIZE;
+#ifdef OPENMP
+#pragma omp parallel for
+#endif
+	for (int y = 0; y < resY; y++)
+	{
+		const Vec3* rows[3];
+		for (int j = 0; j < 3; j++)
+			rows[j] = in + border_coord(y + j - 1, resY, border) * resX;
+		for (int x = 0; x < resX; x++)
+		{
+			int cols[3];
+			for (int i = 0; i < 3; i++)
+				cols[i] = border_coord(x + i - 1, resX, border);
+			if (normalize && (x == 0 || y == 0 || x == resX - 1 || y == resY - 1))
+			{
+				// The window is clipped to the pixels inside the image, which
+				// always include the center.
+				for (int c = 0; c < 3; c++)
+				{
+					float p[9];
+					p[0] = rows[1][x][c];
+					int n = 1;
+					for (int j = 0; j < 3; j++)
+						for (int i = 0; i < 3; i++)
+							if ((i != 1 || j != 1) && y + j - 1 >= 0 && y + j - 1 < resY
+									&& x + i - 1 >= 0 && x + i - 1 < resX)
+								p[n++] = rows[j][cols[i]][c];
+					out[y * resX + x][c] = median_small(p, n);
+				}
+				continue;
+			}
+			for (int c = 0; c < 3; c++)
+			{
+				float p[9];
+				for (int j = 0; j < 3; j++)
+					for (int i = 0; i < 3; i++)
+						p[j * 3 + i] = rows[j][cols[i]][c];
+				out[y * resX + x][c] = median9(p);
+			}
+		}
+	}
+}
+
+/**
+ * Filters rows y0 .. y1 - 1 of one channel.
+ * @param q The channel quantized to 8 bits, padded by radius pixels on
+ * every side: (resY + 2 radius) rows of resX + 2 radius values.
+ * @param cols resX + 2 radius column histograms.
+ */
+static void median_band(Vec3* out, int channel, const unsigned char* q,
+		const int resX, const int resY, int radius, int border, int y0, int y1,
+		MedianHistogram* cols)
+{
+	const int width = resX + 2 * radius;
+	const int size = 2 * radius + 1;
+	const bool normalize = border == BORDER_NORMALIZE;
+
+	// Column histograms of the padded rows y0 .. y0 + 2 radius; pixels
+	// outside the image are left out with BORDER_NORMALIZE.
+	memset(cols, 0, width * sizeof(MedianHistogram));
+	for (int py = y0; py < y0 + size; py++)
+	{
+		if (normalize && (py < radius || py >= resY + radius))
+			continue;
+		const unsigned char* row = q + py * width;
+		for (int px = 0; px < width; px++)
+		{
+			if (normalize && (px < radius || px >= resX + radius))
+				continue;
+			cols[px].coarse[row[px] >> 4]++;
+			cols[px].fine[row[px]]++;
+		}
+	}
+
+	MedianHistogram window;
+	for (int y = y0; y < y1; y++)
+	{
+		if (y > y0)
+		{
+			// Moves the column histograms down by one row.
+			const unsigned char* top = q + (y - 1) * width;
+			const unsigned char* bottom = q + (y + 2 * radius) * width;
+			bool removeTop = !normalize || y - 1 >= radius;
+			bool addBottom = !normalize || y + radius < resY;
+			for (int px = 0; px < width; px++)
+			{
+				if (normalize && (px < radius || px >= resX + radius))
+					continue;
+				if (removeTop)
+				{
+					cols[px].coarse[top[px] >> 4]--;
+					cols[px].fine[top[px]]--;
+				}
+				if (addBottom)
+				{
+					cols[px].coarse[bottom[px] >> 4]++;
+					cols[px].fine[bottom[px]]++;
+				}
+			}
+		}
+
+		int rowsInside = size;
+		if (normalize)
+			rowsInside = (y + radius < resY ? y + radius : resY - 1)
+					- (y - radius > 0 ? y - radius : 0) + 1;
+
+		memset(&window, 0, sizeof(window));
+		for (int px = 0; px < size; px++)
+			histogram_add(window, cols[px]);
+		for (int x = 0; x < resX; x++)
+		{
+			if (x > 0)
+			{
+				histogram_add(window, cols[x + 2 * radius]);
+				histogram_sub(window, cols[x - 1]);
+			}
+			int count = size * size;
+			if (normalize)
+				count = rowsInside
+						* ((x + radius < resX ? x + radius : resX - 1)
+								- (x - radius > 0 ? x - radius : 0) + 1);
+			out[y * resX + x][channel] = histogram_select(window,
+					(count - 1) / 2) / 255.0f;
+		}
+	}
+}
+
+void median_filter(Vec3* out, const Vec3* in, const int resX, const int resY,
+		int radius, int border)
+{
+	if (radius <= 0)
+	{
+		memcpy(out, in, resX * resY * sizeof(Vec3));
+		return;
+	}
+	if (radius == 1)
+	{
+		median3x3(out, in, resX, resY, border);
+		return;
+	}
+	if (radius > MEDIAN_MAX_RADIUS)
+		radius = MEDIAN_MAX_RADIUS;
+
+	// Quantized channels, padded according to the border mode.
+	const int width = resX + 2 * radius;
+	const int height = resY + 2 * radius;
+	unsigned char* q = new unsigned char[3 * width * height];
+	for (int py = 0; py < height; py++)
+	{
+		int sy = border_coord(py - radius, resY, border);
+		for (int px = 0; px < width; px++)
+		{
+			const Vec3& v = in[sy * resX + border_coord(px - radius, resX, border)];
+			for (int c = 0; c < 3; c++)
+			{
+				float f = v[c] * 255.0f + 0.5f;
+				q[(c * height + py) * width + px] = (unsigned char) (
+						f < 0.0f ? 0.0f : (f > 255.0f ? 255.0f : f));
+			}
+		}
+	}
+
+	const int numBands = (resY + MEDIAN_BAND - 1) / MEDIAN_BAND;
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+	{
+		MedianHistogram* cols = new MedianHistogram[width];
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for (int band = 0; band < numBands; band++)
+		{
+			int y0 = band * MEDIAN_BAND;
+			int y1 = y0 + MEDIAN_BAND < resY ? y0 + MEDIAN_BAND : resY;
+			for (int c = 0; c < 3; c++)
+				median_band(out, c, q + c * width * height, resX, resY, radius,
+						border, y0, y1, cols);
+		}
+		delete[] cols;
+	}
+
+	delete[] q;
+}
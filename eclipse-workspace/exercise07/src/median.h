@@ -0,0 +1,38 @@
+/**
+ * Median filter whose cost per pixel does not depend on the radius.
+ */
+
+#ifndef MEDIAN_H
+#define MEDIAN_H
+
+#include "vec.h"
+
+/// Number of rows the image is split into for parallel processing.
+#define MEDIAN_BAND 128
+/// Largest radius, so the counts of a window fit into 16 bits.
+#define MEDIAN_MAX_RADIUS 127
+
+/**
+ * Filters every channel of an image with a (2 radius + 1)^2 median filter.
+ * @remarks Radius 1 is computed exactly for every border mode, with a
+ * sorting network where the window lies inside the image. Larger radii
+ * use column histograms as proposed by Perreault and Hebert: one histogram
+ * per column of the window is moved down by one row per pixel row, the
+ * histogram of the window is moved right by adding one column histogram
+ * and subtracting another, so the cost is O(1) per pixel. The histograms
+ * have 256 bins in two levels of 16, so the channels are quantized to 8
+ * bits in [0, 1] (exact for 8 bit images). Bands of MEDIAN_BAND rows are
+ * filtered in parallel (OPENMP).
+ * @param out Output parameter. Contains the filtered image. Must not be in.
+ * @param in Image to process.
+ * @param resX Width of the images in in/out in pixels.
+ * @param resY Height of the images in in/out in pixels.
+ * @param radius Radius of the window, at most MEDIAN_MAX_RADIUS.
+ * @param border ConvolutionBorder. With BORDER_NORMALIZE the median of the
+ * pixels of the window inside the image is taken (the lower one of the two
+ * middle values for an even number of them).
+ */
+void median_filter(Vec3* out, const Vec3* in, const int resX, const int resY,
+		int radius, int border);
+
+#endif